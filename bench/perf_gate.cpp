@@ -0,0 +1,685 @@
+// Headless performance regression gate.
+//
+// Runs the Ctrl+1/Ctrl+2 processing chain stage by stage on a fixed synthetic
+// nuclei image, measures per-stage time (median of N runs) and peak cv::Mat
+// memory, and compares both against a committed baseline JSON. Exits non-zero
+// when any stage regresses beyond the baseline's tolerances, so CTest fails.
+//
+// The committed baseline holds what does not depend on the machine (peak
+// memory, large allocations, pool misses) for every stage. Times vary per
+// machine: they are gated only where the baseline or a --timings file has
+// them, so the default CTest run gates memory only. Stages missing from the
+// baseline fail, as does a baseline that cannot be read; CMake registers the
+// test only once the committed baseline has recorded stages.
+//
+//   CytoPerfGate --baseline bench/perf_baseline.json [--timings machine.json]
+//                [--reps 7] [--size 2048] [--out results.json] [--update-baseline]
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <stack>
+#include <string>
+#include <vector>
+
+#include "bitmask.h"
+#include "functiondec.h"
+#include "imagehandle.h"
+#include "matpool.h"
+#include "morphology.h"
+#include "mattracker.h"
+#include "pipeline.h"
+#include "simdkernels.h"
+#include "tuning.h"
+
+
+// --------------------------- //
+// ------ Bench Helpers ------ //
+// --------------------------- //
+
+struct StageResult {
+    double medianMs = 0.0;
+    double madMs = 0.0;   // median absolute deviation, used as the noise estimate
+    double peakMB = 0.0;  // peak cv::Mat bytes above what was live before the stage
+    double largeAllocs = 0.0;
+    double poolMisses = 0.0;  // MatPool buffers that had to be allocated
+    bool timed = true;        // baseline entries: median_ms/mad_ms present
+};
+
+struct Tolerance {
+    double timePct = 15.0;      // allowed slowdown relative to baseline median
+    double timeFloorMs = 2.0;   // absolute slack so tiny stages don't flap
+    double madFactor = 3.0;     // extra slack in units of measured noise
+    double memoryPct = 10.0;    // allowed peak memory growth
+    double memoryFloorMB = 1.0;
+};
+
+static double median(std::vector<double> v)
+{
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return (n % 2) ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+// Whole-string integer, as in the CLI
+static bool parseCount(const std::string& text, long& value)
+{
+    try {
+        size_t used = 0;
+        value = std::stol(text, &used);
+        return used == text.size();
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+}
+
+// Deterministic BGR test frame: dim noisy background with bright blue "nuclei",
+// some of them touching so the watershed has something to split.
+static cv::Mat makeSyntheticNuclei(int size, int nuclei)
+{
+    cv::RNG rng(0xC470);
+    cv::Mat img(size, size, CV_8UC3, cv::Scalar(12, 10, 10));
+
+    for (int i = 0; i < nuclei; ++i) {
+        cv::Point center(rng.uniform(0, size), rng.uniform(0, size));
+        int radius = rng.uniform(size / 120 + 4, size / 50 + 8);
+        int blue = rng.uniform(150, 250);
+        cv::circle(img, center, radius, cv::Scalar(blue, blue / 4, blue / 5), -1, cv::LINE_AA);
+        if (i % 5 == 0) {
+            // touching partner
+            cv::Point partner(center.x + radius + radius / 2, center.y);
+            cv::circle(img, partner, radius, cv::Scalar(blue, blue / 4, blue / 5), -1, cv::LINE_AA);
+        }
+    }
+
+    cv::Mat noise(img.size(), CV_16SC3);
+    cv::randn(noise, cv::Scalar::all(0), cv::Scalar::all(6));
+    cv::add(img, noise, img, cv::noArray(), img.type());
+    return img;
+}
+
+// Outline length of every object (index = object, as in LabelRuns), from
+// its outer contours at full resolution
+static std::vector<double> objectPerimeters(const LabelRuns& objects)
+{
+    const std::vector<ComponentStats> stats = objects.stats();
+    const cv::Rect frame(0, 0, objects.size().width, objects.size().height);
+    std::vector<double> perimeters(objects.count(), 0.0);
+    cv::Mat mask;
+    for (int i = 0; i < objects.count(); ++i) {
+        cv::Rect box = stats[i].bbox();
+        const cv::Rect roi = cv::Rect(box.x - 1, box.y - 1, box.width + 2, box.height + 2) & frame;
+        objects.objectMask(i, roi, mask);
+        std::vector<std::vector<cv::Point>> contours;
+        cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+        for (const std::vector<cv::Point>& contour : contours) perimeters[i] += cv::arcLength(contour, true);
+    }
+    return perimeters;
+}
+
+// Times `fn` `reps` times after one warm-up run and records the worst peak
+// memory seen. `fn` leaves its result in captured variables for the next stage.
+static StageResult measureStage(const std::function<void()>& fn, int reps)
+{
+    TrackingMatAllocator& tracker = matTracker();
+    fn(); // warm-up: first-touch page faults, OpenCV thread pool spin-up
+
+    std::vector<double> times;
+    double peakMB = 0.0;
+    double largeAllocs = 0.0;
+    double poolMisses = 0.0;
+    for (int i = 0; i < reps; ++i) {
+        tracker.resetPeak();
+        size_t liveBefore = tracker.live();
+        size_t missesBefore = matPool().missCount();
+
+        int64 start = cv::getTickCount();
+        fn();
+        int64 stop = cv::getTickCount();
+
+        times.push_back(1000.0 * (stop - start) / cv::getTickFrequency());
+        peakMB = std::max(peakMB, (tracker.peak() - liveBefore) / (1024.0 * 1024.0));
+        largeAllocs = std::max(largeAllocs, static_cast<double>(tracker.largeAllocationCount()));
+        poolMisses = std::max(poolMisses, static_cast<double>(matPool().missCount() - missesBefore));
+    }
+
+    StageResult r;
+    r.medianMs = median(times);
+    std::vector<double> dev;
+    for (double t : times) dev.push_back(std::abs(t - r.medianMs));
+    r.madMs = median(dev);
+    r.peakMB = peakMB;
+    r.largeAllocs = largeAllocs;
+    r.poolMisses = poolMisses;
+    return r;
+}
+
+// --------------------------- //
+// ----- ^Bench Helpers^ ----- //
+// --------------------------- //
+
+
+
+
+// --------------------------- //
+// ----- Baseline (JSON) ----- //
+// --------------------------- //
+
+// False if the file cannot be read or lists no stages
+static bool loadBaseline(const std::string& path, Tolerance& tol, std::map<std::string, StageResult>& stages)
+{
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) return false;
+
+    cv::FileNode t = fs["tolerance"];
+    if (!t.empty()) {
+        if (!t["time_pct"].empty()) tol.timePct = (double)t["time_pct"];
+        if (!t["time_floor_ms"].empty()) tol.timeFloorMs = (double)t["time_floor_ms"];
+        if (!t["mad_factor"].empty()) tol.madFactor = (double)t["mad_factor"];
+        if (!t["memory_pct"].empty()) tol.memoryPct = (double)t["memory_pct"];
+        if (!t["memory_floor_mb"].empty()) tol.memoryFloorMB = (double)t["memory_floor_mb"];
+    }
+
+    cv::FileNode s = fs["stages"];
+    for (cv::FileNodeIterator it = s.begin(); it != s.end(); ++it) {
+        cv::FileNode node = *it;
+        StageResult r;
+        r.timed = !node["median_ms"].empty();
+        r.medianMs = (double)node["median_ms"];
+        r.madMs = (double)node["mad_ms"];
+        r.peakMB = (double)node["peak_mb"];
+        r.largeAllocs = (double)node["large_allocs"];
+        r.poolMisses = (double)node["pool_misses"];
+        stages[node.name()] = r;
+    }
+    return !stages.empty();
+}
+
+// Per-machine times ("stages": { name: { median_ms, mad_ms } }) over the baseline's
+static bool loadTimings(const std::string& path, std::map<std::string, StageResult>& stages)
+{
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) return false;
+
+    cv::FileNode s = fs["stages"];
+    for (cv::FileNodeIterator it = s.begin(); it != s.end(); ++it) {
+        cv::FileNode node = *it;
+        auto entry = stages.find(node.name());
+        if (entry == stages.end() || node["median_ms"].empty()) continue;
+        entry->second.timed = true;
+        entry->second.medianMs = (double)node["median_ms"];
+        entry->second.madMs = (double)node["mad_ms"];
+    }
+    return true;
+}
+
+// Fields per stage: times and/or the machine-independent memory counts
+static void writeResults(const std::string& path, const Tolerance& tol,
+                         const std::vector<std::pair<std::string, StageResult>>& results,
+                         bool times = true, bool memory = true)
+{
+    cv::FileStorage fs(path, cv::FileStorage::WRITE | cv::FileStorage::FORMAT_JSON);
+
+    fs << "tolerance" << "{";
+    fs << "time_pct" << tol.timePct;
+    fs << "time_floor_ms" << tol.timeFloorMs;
+    fs << "mad_factor" << tol.madFactor;
+    fs << "memory_pct" << tol.memoryPct;
+    fs << "memory_floor_mb" << tol.memoryFloorMB;
+    fs << "}";
+
+    fs << "stages" << "{";
+    for (const auto& [name, r] : results) {
+        fs << name << "{";
+        if (times) {
+            fs << "median_ms" << r.medianMs;
+            fs << "mad_ms" << r.madMs;
+        }
+        if (memory) {
+            fs << "peak_mb" << r.peakMB;
+            fs << "large_allocs" << r.largeAllocs;
+            fs << "pool_misses" << r.poolMisses;
+        }
+        fs << "}";
+    }
+    fs << "}";
+}
+
+// --------------------------- //
+// ---- ^Baseline (JSON)^ ---- //
+// --------------------------- //
+
+
+
+
+int main(int argc, char** argv)
+{
+    std::string baselinePath;
+    std::string timingsPath;
+    std::string outPath;
+    bool updateBaseline = false;
+    int reps = 7;
+    int size = 2048;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--baseline" && i + 1 < argc) baselinePath = argv[++i];
+        else if (arg == "--timings" && i + 1 < argc) timingsPath = argv[++i];
+        else if (arg == "--out" && i + 1 < argc) outPath = argv[++i];
+        else if (arg == "--reps" && i + 1 < argc) {
+            long value = 0;
+            if (!parseCount(argv[++i], value) || value < 1 || value > 1000) {
+                std::cerr << "--reps expects a run count from 1 to 1000, got '" << argv[i] << "'\n";
+                return 2;
+            }
+            reps = static_cast<int>(value);
+        }
+        else if (arg == "--size" && i + 1 < argc) {
+            // The blur check drops 3 sigma (60 px at sigma 20) on every side
+            long value = 0;
+            if (!parseCount(argv[++i], value) || value < 256 || value > 16384) {
+                std::cerr << "--size expects a frame side from 256 to 16384 pixels, got '" << argv[i] << "'\n";
+                return 2;
+            }
+            size = static_cast<int>(value);
+        }
+        else if (arg == "--update-baseline") updateBaseline = true;
+        else {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            return 2;
+        }
+    }
+
+    installMatTracker();
+
+    const cv::Mat original = makeSyntheticNuclei(size, size / 16);
+
+    // Stage chain mirrors Ctrl+1 / Ctrl+2. Each lambda reads the previous
+    // stage's output so every stage is timed on realistic input.
+    cv::Mat blueOnly, gray, blurred, binary;
+    WatershedOutput wsOpenCV, wsCustom, wsPriority, wsCoarse;
+    LabelRuns customRuns;
+    std::vector<double> nsis;
+    cv::Mat heatmap;
+    const ExecutionPlan customPlan = compilePipeline(builtinRecipe("custom_watershed"));
+    Recipe backgroundRecipe = builtinRecipe("custom_watershed");
+    for (StageSpec& stage : backgroundRecipe.stages)
+        if (stage.id == "background") stage.params["method"] = BACKGROUND_TOPHAT;
+    const ExecutionPlan backgroundPlan = compilePipeline(backgroundRecipe);
+    PipelineValue pipelineInput;
+    pipelineInput.image = original;
+    PipelineSession session(builtinRecipe("custom_watershed"));
+    session.setInput(pipelineInput);
+    session.run();
+    bool highFraction = false;
+    ProxyTuner tuner(builtinRecipe("custom_watershed"));
+    tuner.setSource(original);
+    TuningParams tuning = tuner.params();
+
+    // Batch of distinct same-sized frames; after the warm-up image every
+    // stage buffer should come from the pool
+    std::vector<cv::Mat> batch = { original };
+    for (int code : { 0, 1, -1 }) {
+        cv::Mat flipped;
+        cv::flip(original, flipped, code);
+        batch.push_back(flipped);
+    }
+
+    // Row kernels against the OpenCV calls they replace, on the same data
+    cv::Mat kernelOut, grayPlane;
+    cv::cvtColor(original, grayPlane, cv::COLOR_BGR2GRAY);
+    std::vector<uint64_t> bits(((size + 63) / 64) * static_cast<size_t>(size));
+    const double fixedLevel = 100.0;
+    cv::Mat binaryPlane;
+    cv::threshold(grayPlane, binaryPlane, fixedLevel, 255, cv::THRESH_BINARY);
+    const cv::Mat rect3 = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
+    BitMask packed = BitMask::pack(binaryPlane);
+
+    // Seeds for the flood step alone, prepared as the custom engine does
+    const WatershedParams floodParams = customWatershedDefaults();
+    const cv::Mat floodOpening = watershedOpening(binaryPlane, floodParams.openIterations);
+    const cv::Mat floodDistance = watershedDistance(floodOpening);
+    const cv::Mat floodSeeds = watershedSeedMarkers(
+        watershedSureBackground(floodOpening, floodParams.dilateIterations),
+        watershedSureForeground(floodDistance, floodParams.thresholdFraction, floodParams.closingKernel));
+    cv::Mat floodMarkers;
+    cv::Mat bfsFlooded = matPool().copyOf(floodSeeds);
+    floodBFS(bfsFlooded);
+    std::vector<ComponentStats> componentStats;
+    cv::Mat cvStats, cvCentroids;
+
+    // Sparse plate: the same nuclei in one corner, 84% background
+    cv::Mat sparsePlate = cv::Mat::zeros(binaryPlane.size(), CV_8UC1);
+    const cv::Rect plateCorner(0, 0, size * 2 / 5, size * 2 / 5);
+    cv::Mat plateNuclei = sparsePlate(plateCorner);
+    binaryPlane(plateCorner).copyTo(plateNuclei);
+
+    // Wide background blur: GaussianBlur's kernel grows with sigma, the
+    // recursive one does not. 16-bit copy covers the other supported depth.
+    cv::Mat blurOut, original16;
+    original.convertTo(original16, CV_16U, 257.0);
+    cv::Mat grayPlane16;
+    grayPlane.convertTo(grayPlane16, CV_16U, 257.0);
+
+    // Flat-field reference: a heavily blurred copy stands in for a flat frame
+    cv::Mat syntheticFlat;
+    cv::GaussianBlur(original, syntheticFlat, cv::Size(0, 0), size / 8.0);
+    syntheticFlat += cv::Scalar::all(16);
+    const FlatField flatField(syntheticFlat);
+    const StageParams flatParams = { { "reference", static_cast<double>(registerFlatField(flatField)) } };
+
+    std::vector<std::pair<std::string, std::function<void()>>> stages = {
+        { "channel",          [&] { blueOnly = showBlueChannelOnly(original); } },
+        { "grayscale",        [&] { gray = toGrayscale(blueOnly); } },
+        { "blur",             [&] { blurred = gaussianFilter(gray); } },
+        { "threshold",        [&] { binary = intensityThreshold(blurred); } },
+        { "watershed_opencv", [&] { wsOpenCV = runWatershed(binary); } },
+        { "watershed_custom", [&] { wsCustom = runCustomWatershed(binary); } },
+        { "watershed_priority", [&] { wsPriority = runPriorityWatershed(binary); } },
+        // Custom engine at 1/4 scale plus a full-resolution boundary band
+        { "watershed_coarse", [&] { wsCoarse = runCoarseWatershed(binary); } },
+        { "nsi",              [&] { nsis = calculateNSI(wsCustom.markers); } },
+        { "heatmap",          [&] { heatmap = createNSIHeatmap(wsCustom.markers, nsis); } },
+        // Colourized view, built only when a result is shown or saved
+        { "colorize",         [&] { heatmap = colorizeMarkers(wsCustom.markers); } },
+        // Same features from the run-length objects
+        { "label_runs",       [&] { customRuns = LabelRuns(wsCustom.markers); } },
+        { "nsi_runs",         [&] { nsis = calculateNSI(customRuns); } },
+        { "heatmap_runs",     [&] { heatmap = createNSIHeatmap(customRuns, nsis); } },
+        // Whole Ctrl+2 recipe through the compiled plan (fused per-pixel stages)
+        { "pipeline_custom",  [&] { runPipeline(customPlan, pipelineInput); } },
+        // Same recipe answered from the stage cache (warm-up fills it): input hash + lookup
+        { "pipeline_cached",  [&] { runPipeline(customPlan, pipelineInput, nullptr, &stageCache()); } },
+        // Slider-style edit: only sure_fg and what follows it re-run
+        { "session_retune",   [&] {
+            highFraction = !highFraction;
+            session.setParam("sure_fg", "threshold_fraction", highFraction ? 0.2 : 0.1);
+            session.run();
+        } },
+        { "batch_steady",     [&] {
+            for (const cv::Mat& frame : batch) {
+                PipelineValue in;
+                in.image = frame;
+                runPipeline(customPlan, in);
+            }
+        } },
+        // Tuning window feedback while a slider moves (proxy scale)
+        { "tuning_preview",   [&] {
+            tuning.thresholdFraction = tuning.thresholdFraction > 0.15f ? 0.1f : 0.2f;
+            tuner.preview(tuning);
+        } },
+        // Undo growth: what the GUI retains after a Ctrl+2 style sequence of edits
+        { "undo_push",        [&] {
+            std::stack<HistoryEntry> undoStack;
+            const SegmentationHandle stored(wsCustom);  // once per segmentation, as in the GUI
+            for (const cv::Mat& m : { original, blueOnly, gray, blurred, binary })
+                undoStack.push(HistoryEntry{ ImageHandle(m), TRAIT_NONE, stored, nsis });
+        } },
+        { "cv_extract",          [&] { cv::extractChannel(original, kernelOut, 0); } },
+        { "simd_channel",        [&] { simd::extractChannel(original, kernelOut, 0); } },
+        { "cv_gray",             [&] { cv::cvtColor(original, kernelOut, cv::COLOR_BGR2GRAY); } },
+        { "simd_gray",           [&] { simd::bgrToGray(original, kernelOut); } },
+        { "cv_threshold",        [&] { cv::threshold(grayPlane, kernelOut, fixedLevel, 255, cv::THRESH_BINARY); } },
+        { "simd_threshold",      [&] { simd::thresholdBinary(grayPlane, kernelOut, fixedLevel); } },
+        { "simd_threshold_bits", [&] { simd::thresholdBits(grayPlane, bits.data(), (size + 63) / 64, fixedLevel); } },
+        { "blur_s20",            [&] { blurOut = gaussianFilter(original, 20.0); } },
+        { "blur_recursive_s3",   [&] { blurOut = gaussianFilter(original, 3.0, BLUR_RECURSIVE); } },
+        { "blur_recursive_s20",  [&] { blurOut = gaussianFilter(original, 20.0, BLUR_RECURSIVE); } },
+        { "blur_recursive_16u",  [&] { blurOut = gaussianFilter(original16, 20.0, BLUR_RECURSIVE); } },
+        // Background subtraction on a 16-bit frame, then the whole Ctrl+2 chain with it enabled
+        { "background_tophat_16u", [&] { blurOut = subtractBackground(original16, BACKGROUND_TOPHAT, 50); } },
+        { "background_blur_16u",   [&] { blurOut = subtractBackground(original16, BACKGROUND_BLUR, 50); } },
+        { "pipeline_background",   [&] { runPipeline(backgroundPlan, pipelineInput); } },
+        // Flat-field correction: one multiply-add pass over the frame
+        { "flat_field_apply",      [&] { flatField.apply(original, kernelOut); } },
+        { "flat_field_stage",      [&] { applyStage("flat_field", pipelineInput, flatParams); } },
+        // Local thresholds: integral images make the window size irrelevant
+        { "local_sauvola_w51",   [&] { binary = intensityThreshold(blurred, -1.0, LocalThreshold{ LOCAL_THRESH_SAUVOLA, 51, 0.2, 0.0 }); } },
+        { "local_sauvola_w301",  [&] { binary = intensityThreshold(blurred, -1.0, LocalThreshold{ LOCAL_THRESH_SAUVOLA, 301, 0.2, 0.0 }); } },
+        { "local_niblack_16u",   [&] { localThreshold(grayPlane16, kernelOut, LocalThreshold{ LOCAL_THRESH_NIBLACK, 51, 0.2, 0.0 }); } },
+        // Large elements for background removal: OpenCV vs running min/max
+        { "cv_close_rect31",     [&] { cv::morphologyEx(grayPlane, kernelOut, cv::MORPH_CLOSE, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(31, 31))); } },
+        { "fast_close_rect31",   [&] { fastMorphology(grayPlane, kernelOut, cv::MORPH_CLOSE, cv::MORPH_RECT, cv::Size(31, 31)); } },
+        { "cv_close_disk31",     [&] { cv::morphologyEx(grayPlane, kernelOut, cv::MORPH_CLOSE, cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(31, 31))); } },
+        { "fast_close_disk31",   [&] { fastMorphology(grayPlane, kernelOut, cv::MORPH_CLOSE, cv::MORPH_ELLIPSE, cv::Size(31, 31)); } },
+        { "fast_open_3x3_it8",   [&] { fastMorphology(grayPlane, kernelOut, cv::MORPH_OPEN, cv::MORPH_RECT, cv::Size(3, 3), 8); } },
+        // Watershed opening (3x3, 2 iterations) on bytes vs on the packed mask
+        { "cv_opening",          [&] { cv::morphologyEx(binaryPlane, kernelOut, cv::MORPH_OPEN, rect3, cv::Point(-1, -1), 2); } },
+        { "bit_opening",         [&] { packed = openRect(BitMask::pack(binaryPlane), cv::Size(3, 3), 2); } },
+        // Debris removal by area on the component tree: mask and grey frame
+        { "area_opening_mask",   [&] { areaOpening(binaryPlane, kernelOut, 100); } },
+        { "area_opening_gray",   [&] { areaOpening(grayPlane, kernelOut, 100); } },
+        { "area_opening_16u",    [&] { areaOpening(grayPlane16, kernelOut, 100); } },
+        // Flood step alone on the same seeds: cv::watershed, breadth-first, bucket-queue priority flood
+        { "flood_opencv",        [&] { floodMarkers = matPool().copyOf(floodSeeds); floodOpenCV(binaryPlane, floodMarkers); } },
+        { "flood_bfs",           [&] { floodMarkers = matPool().copyOf(floodSeeds); floodBFS(floodMarkers); } },
+        { "flood_priority",      [&] { floodMarkers = matPool().copyOf(floodSeeds); floodPriority(floodDistance, floodMarkers); } },
+        // Outlier regions re-segmented in their own boxes, after the breadth-first flood
+        { "split_large",         [&] { floodMarkers = matPool().copyOf(bfsFlooded); splitLargeRegions(floodMarkers); } },
+        // Labeling the thresholded frame: OpenCV vs strip-parallel union-find, with and without statistics
+        { "cv_components",       [&] { cv::connectedComponents(binaryPlane, floodMarkers, 8, CV_32S); } },
+        { "label_components",    [&] { labelComponents(binaryPlane, floodMarkers); } },
+        { "cv_components_stats", [&] { cv::connectedComponentsWithStats(binaryPlane, floodMarkers, cvStats, cvCentroids, 8, CV_32S); } },
+        { "label_stats",         [&] { labelComponents(binaryPlane, floodMarkers, 8, &componentStats); } },
+        // Seeds at one fraction vs seed/object counts at 49 fractions from the same distance transform
+        { "seeds_one_fraction",  [&] { labelComponents(watershedSureForeground(floodDistance, 0.4, 0), floodMarkers); } },
+        { "fraction_sweep",      [&] { sweepThresholdFractions(floodOpening, floodDistance, sweepFractions(49)); } },
+        // Sparse plate: distance transform over every pixel vs over the occupied tiles only
+        { "tile_occupancy",      [&] { TileOccupancy occupancy(binaryPlane); } },
+        { "distance_dense",      [&] { cv::distanceTransform(sparsePlate, kernelOut, cv::DIST_L2, 5); } },
+        { "distance_sparse",     [&] { watershedDistance(sparsePlate); } },
+        { "custom_sparse_plate", [&] { runCustomWatershed(sparsePlate); } },
+    };
+
+    // Correctness checks on the same frame; a failure fails the gate like a regression
+    bool wrong = false;
+    std::cout << "Row kernels: " << simd::kernels().isa << "\n";
+    for (double sigma : { 3.0, 20.0 }) {
+        // Within a few grey levels of GaussianBlur beyond 3 sigma from the
+        // borders (see recursiveblur.h); the whole-frame mean includes them
+        const double maxAllowed = 8.0, meanAllowed = 1.5;
+        cv::Mat exact = gaussianFilter(original, sigma);
+        cv::Mat fast = gaussianFilter(original, sigma, BLUR_RECURSIVE);
+        cv::Mat diff;
+        cv::absdiff(exact, fast, diff);
+        const int border = static_cast<int>(std::ceil(3.0 * sigma));
+        cv::Mat interior = diff(cv::Rect(border, border, diff.cols - 2 * border, diff.rows - 2 * border));
+        double maxDiff = 0.0;
+        cv::minMaxLoc(interior.reshape(1), nullptr, &maxDiff);
+        const double meanDiff = cv::mean(diff.reshape(1))[0];
+        const bool bad = maxDiff > maxAllowed || meanDiff > meanAllowed;
+        std::cout << cv::format("Recursive blur vs GaussianBlur, sigma %.0f: max diff %.0f (interior, limit %.0f), mean diff %.3f (limit %.1f)%s\n",
+                                sigma, maxDiff, maxAllowed, meanDiff, meanAllowed, bad ? "  [FAIL]" : "");
+        wrong = wrong || bad;
+    }
+    std::cout << cv::format("Objects found: opencv %d, custom %d, priority %d\n",
+                            runWatershed(binaryPlane).count, runCustomWatershed(binaryPlane).count,
+                            runPriorityWatershed(binaryPlane).count);
+    {
+        // Label storage per segmentation: dense CV_32S, compacted, as runs
+        WatershedOutput custom = runCustomWatershed(binaryPlane);
+        LabelRuns runs(custom.markers);
+        cv::Mat restored;
+        runs.toMarkers(restored, custom.markers.type());
+        // The runs must give back exactly the markers they were built from
+        const bool bad = restored.type() != custom.markers.type() || cv::countNonZero(restored != custom.markers) != 0;
+        std::cout << cv::format("Label storage: %.2f MB CV_32S, %.2f MB compact, %.2f MB runs (%d objects), restore %s\n",
+                                custom.markers.total() * 4 / 1048576.0,
+                                custom.markers.total() * custom.markers.elemSize() / 1048576.0,
+                                runs.bytes() / 1048576.0, runs.count(), bad ? "MISMATCH  [FAIL]" : "exact");
+        wrong = wrong || bad;
+    }
+    {
+        // Coarse-to-fine against the full-resolution custom engine, object by
+        // object: each full-res object is matched to the coarse object under
+        // its centroid. Median area and perimeter errors must stay within
+        // tolerance, and nearly every object must find a match.
+        const double maxMedianError = 0.05, minMatched = 0.9;
+        WatershedOutput full = runCustomWatershed(binaryPlane), coarse = runCoarseWatershed(binaryPlane);
+        LabelRuns fullRuns(full.markers), coarseRuns(coarse.markers);
+        std::vector<ComponentStats> fullStats = fullRuns.stats(), coarseStats = coarseRuns.stats();
+        std::vector<double> fullPerimeter = objectPerimeters(fullRuns), coarsePerimeter = objectPerimeters(coarseRuns);
+        std::vector<double> fullNSI = calculateNSI(fullRuns), coarseNSI = calculateNSI(coarseRuns);
+        const cv::Mat coarseWide = widenMarkers(coarse.markers);
+        const std::vector<int>& coarseLabels = coarseRuns.labels();
+
+        std::vector<double> areaErr, perimeterErr, nsiErr;
+        for (int i = 0; i < fullRuns.count(); ++i) {
+            cv::Point2d c = fullStats[i].centroid();
+            int label = coarseWide.at<int>(cvRound(c.y), cvRound(c.x));
+            auto at = std::lower_bound(coarseLabels.begin(), coarseLabels.end(), label);
+            if (label < 2 || at == coarseLabels.end() || *at != label) continue;
+            const size_t j = at - coarseLabels.begin();
+            areaErr.push_back(std::abs(coarseStats[j].area - fullStats[i].area) / double(fullStats[i].area));
+            perimeterErr.push_back(std::abs(coarsePerimeter[j] - fullPerimeter[i]) / std::max(1.0, fullPerimeter[i]));
+            nsiErr.push_back(std::abs(coarseNSI[j] - fullNSI[i]));
+        }
+        const double matched = fullRuns.count() ? areaErr.size() / double(fullRuns.count()) : 1.0;
+        const bool bad = median(areaErr) > maxMedianError || median(perimeterErr) > maxMedianError || matched < minMatched;
+        std::cout << cv::format("Coarse-to-fine: %d objects (custom %d), %.0f%% matched (limit %.0f%%), median area error %.1f%%, "
+                                "perimeter error %.1f%% (limit %.0f%%), median NSI error %.3f%s\n",
+                                coarse.count, full.count, 100.0 * matched, 100.0 * minMatched, 100.0 * median(areaErr),
+                                100.0 * median(perimeterErr), 100.0 * maxMedianError, median(nsiErr), bad ? "  [FAIL]" : "");
+        wrong = wrong || bad;
+    }
+    {
+        // The sweep's counts must match labeling each fraction's sure foreground
+        FractionSweep sweep = sweepThresholdFractions(floodOpening, floodDistance, { 0.1, 0.5 });
+        int direct[2];
+        for (int i = 0; i < 2; ++i)
+            direct[i] = labelComponents(watershedSureForeground(floodDistance, sweep.fractions[i], 0), floodMarkers) - 1;
+        const bool bad = sweep.seeds[0] != direct[0] || sweep.seeds[1] != direct[1];
+        std::cout << cv::format("Fraction sweep: %d blobs; seeds at 0.1 %d (direct %d), at 0.5 %d (direct %d)%s\n",
+                                sweep.blobs, sweep.seeds[0], direct[0], sweep.seeds[1], direct[1], bad ? "  [FAIL]" : "");
+        wrong = wrong || bad;
+    }
+    {
+        // An undo entry keeps its pixels after the current image is edited.
+        // As in the GUI: push the current handle, run the chain on it, show
+        // the result, then churn the pool so a wrongly freed buffer is reused.
+        std::stack<HistoryEntry> undoStack;
+        ImageHandle current(showBlueChannelOnly(original));
+        const cv::Mat before = current.view().clone();
+        undoStack.push(HistoryEntry{ current, TRAIT_SINGLE_CHANNEL, SegmentationHandle(), {} });
+        PipelineValue edit;
+        edit.image = current.view();
+        current = ImageHandle(displayImage(runPipeline(customPlan, edit)));
+        for (const cv::Mat& frame : batch) {
+            PipelineValue in;
+            in.image = frame;
+            runPipeline(customPlan, in);
+        }
+        const cv::Mat& kept = undoStack.top().image.view();
+        const bool bad = kept.size() != before.size() || kept.type() != before.type()
+                         || cv::countNonZero(kept.reshape(1) != before.reshape(1)) != 0;
+        std::cout << cv::format("Undo entry after an edit: %s%s\n", bad ? "CHANGED" : "unchanged", bad ? "  [FAIL]" : "");
+        wrong = wrong || bad;
+    }
+    for (int depth : { CV_8U, CV_16U }) {
+        // Niblack and Sauvola on bright discs (smaller than the window) on a
+        // dark flat field: the discs must be kept and the field dropped
+        const double scale = depth == CV_8U ? 1.0 : 257.0, minKept = 0.99, maxBackground = 0.01;
+        cv::Mat frame(256, 256, CV_MAKETYPE(depth, 1), cv::Scalar(11 * scale));
+        cv::Mat discs(frame.size(), CV_8UC1, cv::Scalar(0));
+        for (cv::Point center : { cv::Point(40, 40), cv::Point(128, 60), cv::Point(200, 200), cv::Point(70, 190) }) {
+            cv::circle(frame, center, 12, cv::Scalar(200 * scale), -1);
+            cv::circle(discs, center, 12, cv::Scalar(255), -1);
+        }
+        const int discPixels = cv::countNonZero(discs), fieldPixels = static_cast<int>(discs.total()) - discPixels;
+        for (int method : { LOCAL_THRESH_NIBLACK, LOCAL_THRESH_SAUVOLA }) {
+            cv::Mat kept;
+            localThreshold(frame, kept, LocalThreshold{ method, 51, 0.2, 0.0 });
+            if (depth != CV_8U) kept.convertTo(kept, CV_8U);
+            const int keptDiscs = cv::countNonZero(kept & discs);
+            const int keptField = cv::countNonZero(kept) - keptDiscs;
+            const double discShare = keptDiscs / double(discPixels), fieldShare = keptField / double(fieldPixels);
+            const bool bad = discShare < minKept || fieldShare > maxBackground;
+            std::cout << cv::format("Local threshold %s %s: discs kept %.1f%% (limit %.0f%%), field kept %.2f%% (limit %.0f%%)%s\n",
+                                    method == LOCAL_THRESH_NIBLACK ? "Niblack" : "Sauvola", depth == CV_8U ? "8U" : "16U",
+                                    100.0 * discShare, 100.0 * minKept, 100.0 * fieldShare, 100.0 * maxBackground,
+                                    bad ? "  [FAIL]" : "");
+            wrong = wrong || bad;
+        }
+    }
+    std::vector<std::pair<std::string, StageResult>> results;
+    for (const auto& [name, fn] : stages)
+        results.emplace_back(name, measureStage(fn, reps));
+
+    Tolerance tol;
+    std::map<std::string, StageResult> baseline;
+    bool haveBaseline = !baselinePath.empty() && loadBaseline(baselinePath, tol, baseline);
+
+    if (!outPath.empty()) writeResults(outPath, tol, results);
+    if (updateBaseline) {
+        if (baselinePath.empty()) {
+            std::cerr << "--update-baseline needs --baseline <path>\n";
+            return 2;
+        }
+        // Memory counts go to the committed baseline, times only to --timings
+        writeResults(baselinePath, tol, results, false, true);
+        std::cout << "Baseline written to " << baselinePath << "\n";
+        if (!timingsPath.empty()) {
+            writeResults(timingsPath, tol, results, true, false);
+            std::cout << "Timings written to " << timingsPath << "\n";
+        }
+        return 0;
+    }
+    if (!baselinePath.empty() && !haveBaseline) {
+        std::cerr << "Baseline " << baselinePath << " is missing, unreadable or lists no stages. "
+                  << "Record one with --update-baseline.\n";
+        return 2;
+    }
+    if (!timingsPath.empty() && !loadTimings(timingsPath, baseline)) {
+        std::cerr << "Failed to read timings " << timingsPath << "\n";
+        return 2;
+    }
+
+    bool regressed = wrong;
+    for (const auto& [name, r] : results) {
+        std::cout << cv::format("%-18s %9.2f ms (mad %6.2f)  peak %8.2f MB  large allocs %3.0f  pool misses %3.0f",
+                                name.c_str(), r.medianMs, r.madMs, r.peakMB, r.largeAllocs, r.poolMisses);
+
+        // Steady-state batches must be served entirely from the pool
+        if (name == "batch_steady" && r.poolMisses > 0) {
+            std::cout << "  [POOL MISSES IN STEADY STATE]";
+            regressed = true;
+        }
+
+        auto it = baseline.find(name);
+        if (it == baseline.end()) {
+            // A new or renamed stage must be recorded before it is gated
+            std::cout << (haveBaseline ? "  [NO BASELINE ENTRY]\n" : "  [no baseline]\n");
+            regressed = regressed || haveBaseline;
+            continue;
+        }
+        const StageResult& b = it->second;
+
+        double timeLimit = b.medianMs * (1.0 + tol.timePct / 100.0)
+                         + std::max(tol.timeFloorMs, tol.madFactor * std::max(b.madMs, r.madMs));
+        double memLimit = b.peakMB * (1.0 + tol.memoryPct / 100.0) + tol.memoryFloorMB;
+
+        bool slow = b.timed && r.medianMs > timeLimit;
+        bool fat = r.peakMB > memLimit;
+        bool churn = r.largeAllocs > b.largeAllocs;
+        bool misses = r.poolMisses > b.poolMisses;
+        if (slow) std::cout << cv::format("  [TIME REGRESSION > %.2f ms]", timeLimit);
+        if (fat) std::cout << cv::format("  [MEMORY REGRESSION > %.2f MB]", memLimit);
+        if (churn) std::cout << cv::format("  [LARGE ALLOCS > %.0f]", b.largeAllocs);
+        if (misses) std::cout << cv::format("  [POOL MISSES > %.0f]", b.poolMisses);
+        if (!slow && !fat && !churn && !misses) std::cout << (b.timed ? "  [ok]" : "  [ok, time not gated]");
+        std::cout << "\n";
+        regressed = regressed || slow || fat || churn || misses;
+    }
+
+    if (!haveBaseline)
+        std::cout << "No baseline loaded; nothing gated. Record one with --update-baseline.\n";
+
+    return regressed ? 1 : 0;
+}
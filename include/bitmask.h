@@ -0,0 +1,232 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "matpool.h"
+#include "pixelkernels.h"
+#include "simdkernels.h"
+
+
+// ---------------------------------- //
+// ------------ BIT MASK ------------ //
+// ---------------------------------- //
+
+// Binary image at one bit per pixel: pixel x of row y is bit x % 64 of word
+// x / 64 in row(y). A CV_8UC3 0/255 mask takes 24x the memory for the same
+// information. Bits past cols() in the last word of a row are always 0.
+//
+// The words live in a pooled CV_8UC1 Mat (8 bytes per word), so masks are
+// recycled between frames like every other stage buffer and copies share
+// the buffer the same way Mats do.
+class BitMask {
+public:
+    BitMask() {}
+
+    BitMask(int rows, int cols)
+        : nRows(rows), nCols(cols), stride((cols + 63) / 64)
+    {
+        bits = matPool().acquire(rows, static_cast<int>(stride * 8), CV_8UC1);
+    }
+
+    // Nonzero pixels become 1. A 3/4-channel mask is read through
+    // simd::firstPlane().
+    static BitMask pack(const cv::Mat& mask)
+    {
+        CV_Assert(mask.depth() == CV_8U);
+        cv::Mat plane = simd::firstPlane(mask);
+
+        BitMask out(mask.rows, mask.cols);
+        if (out.nRows > 0)
+            simd::thresholdBits(plane, out.row(0), out.stride, 0);
+        return out;
+    }
+
+    // 0/255 in every channel of `type` (CV_8UC1 or CV_8UC3)
+    void unpack(cv::Mat& dst, int type = CV_8UC1) const
+    {
+        CV_Assert(CV_MAT_DEPTH(type) == CV_8U);
+        dst.create(nRows, nCols, type);
+        const int cn = CV_MAT_CN(type);
+        parallelRows(nRows, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) {
+                const uint64_t* words = row(y);
+                uchar* d = dst.ptr<uchar>(y);
+                for (int x = 0; x < nCols; ++x) {
+                    uchar v = (words[x >> 6] >> (x & 63)) & 1 ? 255 : 0;
+                    for (int c = 0; c < cn; ++c) *d++ = v;
+                }
+            }
+        });
+    }
+
+    int rows() const { return nRows; }
+    int cols() const { return nCols; }
+    size_t wordsPerRow() const { return stride; }
+    bool empty() const { return nRows == 0 || nCols == 0; }
+    size_t bytes() const { return stride * 8 * nRows; }
+
+    uint64_t* row(int y) { return reinterpret_cast<uint64_t*>(bits.ptr(y)); }
+    const uint64_t* row(int y) const { return reinterpret_cast<const uint64_t*>(bits.ptr(y)); }
+
+    bool at(int y, int x) const { return (row(y)[x >> 6] >> (x & 63)) & 1; }
+
+    size_t count() const
+    {
+        size_t n = 0;
+        for (int y = 0; y < nRows; ++y) {
+            const uint64_t* words = row(y);
+            for (size_t i = 0; i < stride; ++i) n += std::bitset<64>(words[i]).count();
+        }
+        return n;
+    }
+
+    // Valid bits of the last word in each row
+    uint64_t tailMask() const
+    {
+        int used = nCols - static_cast<int>(stride - 1) * 64;
+        return used == 64 ? ~uint64_t(0) : (uint64_t(1) << used) - 1;
+    }
+
+private:
+    int nRows = 0;
+    int nCols = 0;
+    size_t stride = 0;  // words per row
+    cv::Mat bits;
+};
+
+// ---------------------------------- //
+// ----------- ^BIT MASK^ ----------- //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// ---------- BIT MORPHOLOGY -------- //
+// ---------------------------------- //
+
+// Erosion/dilation with a rectangular element, 64 pixels per word operation.
+// Same result as cv::erode/cv::dilate/cv::morphologyEx with a MORPH_RECT
+// kernel, the default anchor and border: pixels outside the image count as
+// 1 for erosion and 0 for dilation, i.e. they never change the result.
+//
+// A k x k rectangle repeated n times is one (k-1)*n+1 rectangle, and each
+// axis is done separately. Along an axis the window is grown by doubling
+// (acc op= acc shifted by the width covered so far), so the cost is
+// log2(reach) word passes instead of one per pixel of kernel.
+
+namespace bitmorph {
+
+// out pixel x = src pixel x + s (s may be negative); words beyond the row
+// read as `fill`
+inline void shiftRow(const uint64_t* src, uint64_t* out, int words, int s, uint64_t fill)
+{
+    auto word = [&](int i) { return (i < 0 || i >= words) ? fill : src[i]; };
+    const int t = s < 0 ? -s : s;
+    const int q = t >> 6, r = t & 63;
+    for (int i = 0; i < words; ++i) {
+        if (s >= 0)
+            out[i] = r == 0 ? word(i + q) : (word(i + q) >> r) | (word(i + q + 1) << (64 - r));
+        else
+            out[i] = r == 0 ? word(i - q) : (word(i - q) << r) | (word(i - q - 1) >> (64 - r));
+    }
+}
+
+// row[x] = op over row[x - lo .. x + hi], in place
+inline void windowRow(uint64_t* row, uint64_t* tmp, int words, int lo, int hi, bool erode)
+{
+    const uint64_t fill = erode ? ~uint64_t(0) : 0;
+    for (int dir = 1, reach = hi; dir >= -1; dir -= 2, reach = lo) {
+        for (int covered = 0; covered < reach;) {
+            int step = std::min(covered + 1, reach - covered);
+            shiftRow(row, tmp, words, dir * step, fill);
+            for (int i = 0; i < words; ++i) row[i] = erode ? (row[i] & tmp[i]) : (row[i] | tmp[i]);
+            covered += step;
+        }
+    }
+}
+
+inline BitMask rectMorph(const BitMask& src, cv::Size ksize, int iterations, bool erode)
+{
+    CV_Assert(ksize.width > 0 && ksize.height > 0 && iterations >= 0);
+    if (src.empty()) return src;
+
+    const int words = static_cast<int>(src.wordsPerRow());
+    const uint64_t tail = src.tailMask();
+    const int ax = ksize.width / 2, ay = ksize.height / 2;
+    const int left = ax * iterations, right = (ksize.width - 1 - ax) * iterations;
+    const int up = ay * iterations, down = (ksize.height - 1 - ay) * iterations;
+
+    // Horizontal pass, row by row. The padding bits are set to the value that
+    // leaves the result unchanged so the last real pixel sees "outside".
+    BitMask a(src.rows(), src.cols());
+    parallelRows(src.rows(), [&](int y0, int y1) {
+        thread_local std::vector<uint64_t> tmp;
+        tmp.resize(words);
+        for (int y = y0; y < y1; ++y) {
+            uint64_t* row = a.row(y);
+            std::memcpy(row, src.row(y), words * sizeof(uint64_t));
+            if (erode) row[words - 1] |= ~tail;
+            windowRow(row, tmp.data(), words, left, right, erode);
+            row[words - 1] &= tail;
+        }
+    });
+
+    // Vertical pass: whole rows combined, doubling the same way. Rows outside
+    // the image are skipped, which is the same as combining with the fill.
+    BitMask b(src.rows(), src.cols());
+    for (int dir = 1, reach = down; dir >= -1; dir -= 2, reach = up) {
+        for (int covered = 0; covered < reach;) {
+            const int step = std::min(covered + 1, reach - covered);
+            parallelRows(src.rows(), [&](int y0, int y1) {
+                for (int y = y0; y < y1; ++y) {
+                    const uint64_t* s = a.row(y);
+                    uint64_t* d = b.row(y);
+                    int other = y + dir * step;
+                    if (other < 0 || other >= src.rows()) {
+                        std::memcpy(d, s, words * sizeof(uint64_t));
+                        continue;
+                    }
+                    const uint64_t* o = a.row(other);
+                    for (int i = 0; i < words; ++i) d[i] = erode ? (s[i] & o[i]) : (s[i] | o[i]);
+                }
+            });
+            std::swap(a, b);
+            covered += step;
+        }
+    }
+    return a;
+}
+
+}  // namespace bitmorph
+
+inline BitMask erodeRect(const BitMask& src, cv::Size ksize, int iterations = 1)
+{
+    return bitmorph::rectMorph(src, ksize, iterations, true);
+}
+
+inline BitMask dilateRect(const BitMask& src, cv::Size ksize, int iterations = 1)
+{
+    return bitmorph::rectMorph(src, ksize, iterations, false);
+}
+
+// morphologyEx(MORPH_OPEN / MORPH_CLOSE) with `iterations`: all erosions
+// first, then all dilations (or the reverse)
+inline BitMask openRect(const BitMask& src, cv::Size ksize, int iterations = 1)
+{
+    return dilateRect(erodeRect(src, ksize, iterations), ksize, iterations);
+}
+
+inline BitMask closeRect(const BitMask& src, cv::Size ksize, int iterations = 1)
+{
+    return erodeRect(dilateRect(src, ksize, iterations), ksize, iterations);
+}
+
+// ---------------------------------- //
+// --------- ^BIT MORPHOLOGY^ ------- //
+// ---------------------------------- //
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+#include "matpool.h"
+#include "pixelkernels.h"
+#include "recursiveblur.h"
+
+
+// ---------------------------------- //
+// ----------- FLAT FIELD ----------- //
+// ---------------------------------- //
+
+// Flat-field and dark-frame correction:
+//
+//   corrected = (raw - dark) * mean(flat - dark) / (flat - dark)
+//
+// folded once into a per-pixel gain and offset (corrected = raw * gain +
+// offset), so correcting an image is a single multiply-add pass. Build it
+// once per acquisition run and apply it to every image. The mean is per
+// channel, so the colour balance of the channels is kept.
+class FlatField {
+public:
+    FlatField() {}
+
+    // flat/dark: same size and channel count as the images to correct, any
+    // depth. An empty dark frame means no dark current.
+    FlatField(const cv::Mat& flat, const cv::Mat& dark = cv::Mat())
+    {
+        CV_Assert(!flat.empty() && (dark.empty() || (dark.size() == flat.size() && dark.channels() == flat.channels())));
+        const int cn = flat.channels();
+
+        cv::Mat f, d;
+        flat.convertTo(f, CV_32F);
+        if (dark.empty()) d = cv::Mat::zeros(flat.size(), CV_MAKETYPE(CV_32F, cn));
+        else dark.convertTo(d, CV_32F);
+        cv::subtract(f, d, f);
+
+        const cv::Scalar level = cv::mean(f);
+        gain.create(flat.size(), CV_MAKETYPE(CV_32F, cn));
+        offset.create(flat.size(), CV_MAKETYPE(CV_32F, cn));
+        parallelRows(flat.rows, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) {
+                const float* fr = f.ptr<float>(y);
+                const float* dr = d.ptr<float>(y);
+                float* g = gain.ptr<float>(y);
+                float* o = offset.ptr<float>(y);
+                for (int i = 0; i < flat.cols * cn; ++i) {
+                    g[i] = static_cast<float>(level[i % cn]) / std::max(fr[i], 1e-3f);
+                    o[i] = -dr[i] * g[i];
+                }
+            }
+        });
+    }
+
+    bool empty() const { return gain.empty(); }
+    cv::Size size() const { return gain.size(); }
+    int channels() const { return gain.channels(); }
+    const cv::Mat& gainMap() const { return gain; }
+    const cv::Mat& offsetMap() const { return offset; }
+
+    // dst = saturate(src * gain + offset), same type as src
+    void apply(const cv::Mat& src, cv::Mat& dst) const
+    {
+        if (src.size() != gain.size() || src.channels() != gain.channels())
+            CV_Error(cv::Error::StsUnmatchedSizes, "Flat-field reference does not match the image size or channels");
+
+        dst.create(src.size(), src.type());
+        const int len = src.cols * src.channels();
+        dispatchPixelFormat(src.type(), [&](auto fmt) {
+            typedef typename decltype(fmt)::value_type T;
+            parallelRows(src.rows, [&](int y0, int y1) {
+                for (int y = y0; y < y1; ++y) {
+                    const T* s = src.ptr<T>(y);
+                    const float* g = gain.ptr<float>(y);
+                    const float* o = offset.ptr<float>(y);
+                    T* d = dst.ptr<T>(y);
+                    // Branch-free round + clamp so the loop vectorizes
+                    if (std::is_integral<T>::value) {
+                        const float lo = static_cast<float>(std::numeric_limits<T>::min());
+                        const float hi = static_cast<float>(std::numeric_limits<T>::max());
+                        for (int i = 0; i < len; ++i)
+                            d[i] = static_cast<T>(std::min(std::max(s[i] * g[i] + o[i] + 0.5f, lo), hi));
+                    } else {
+                        for (int i = 0; i < len; ++i) d[i] = static_cast<T>(s[i] * g[i] + o[i]);
+                    }
+                }
+            });
+        });
+    }
+
+private:
+    cv::Mat gain;    // CV_32FC(cn)
+    cv::Mat offset;  // CV_32FC(cn), -dark * gain
+};
+
+// Estimates the flat from the images of a run when no reference was
+// recorded: their average, blurred far beyond the size of a cell so only the
+// illumination profile remains. Frames are added one at a time, so a batch
+// never has to be held in memory.
+class FlatFieldEstimator {
+public:
+    void add(const cv::Mat& frame)
+    {
+        if (sum.empty()) sum = cv::Mat::zeros(frame.size(), CV_MAKETYPE(CV_32F, frame.channels()));
+        CV_Assert(frame.size() == sum.size() && frame.channels() == sum.channels());
+        cv::Mat f;
+        frame.convertTo(f, CV_32F);
+        cv::add(sum, f, sum);
+        ++count;
+    }
+
+    int frames() const { return count; }
+
+    FlatField finish(const cv::Mat& dark = cv::Mat()) const
+    {
+        CV_Assert(count > 0);
+        cv::Mat average = sum / count;
+        cv::Mat smooth;
+        recursiveGaussianBlur(average, smooth, std::max(average.rows, average.cols) / 16.0);
+        return FlatField(smooth, dark);
+    }
+
+private:
+    cv::Mat sum;
+    int count = 0;
+};
+
+// Loaded references by id. The flat_field stage takes the id as its
+// `reference` parameter; registerFlatField() (pipeline.h) derives it from
+// the reference's content.
+struct FlatFieldRegistry {
+    std::mutex mutex;
+    std::map<int64_t, std::shared_ptr<const FlatField>> references;
+};
+
+inline FlatFieldRegistry& flatFieldRegistry()
+{
+    static FlatFieldRegistry registry;
+    return registry;
+}
+
+inline void storeFlatField(int64_t id, const FlatField& reference)
+{
+    FlatFieldRegistry& r = flatFieldRegistry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.references[id] = std::make_shared<const FlatField>(reference);
+}
+
+inline std::shared_ptr<const FlatField> flatFieldReference(int64_t id)
+{
+    FlatFieldRegistry& r = flatFieldRegistry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto it = r.references.find(id);
+    return it == r.references.end() ? nullptr : it->second;
+}
+
+// ---------------------------------- //
+// ---------- ^FLAT FIELD^ ---------- //
+// ---------------------------------- //
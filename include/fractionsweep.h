@@ -0,0 +1,145 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <vector>
+
+#include "labeling.h"
+#include "matpool.h"
+#include "pixelkernels.h"
+#include "simdkernels.h"
+
+
+// ---------------------------------- //
+// --------- FRACTION SWEEP --------- //
+// ---------------------------------- //
+
+// Seed counts for many sure-foreground fractions from one opening and one
+// distance transform. The seeds at fraction f are the 8-connected
+// components of {dist > f * max(dist)}, exactly what
+// watershedSureForeground + watershedSeedMarkers make without the closing.
+// These are raw counts: the closing merges nearby seeds and
+// splitLargeRegions adds regions afterwards, so the watershed's region count
+// differs. As f drops, pixels only join, so one incremental union-find
+// over the pixels in order of the fraction at which they appear yields the
+// component count at every fraction. Pixels only need bucketing by
+// fraction, not a full sort. Cost: about one labeling pass.
+
+struct FractionSweep {
+    int blobs = 0;                  // components of the opening (candidate nuclei)
+    std::vector<double> fractions;  // ascending
+    std::vector<int> seeds;         // raw sure-foreground components (no closing, no splitting)
+    std::vector<int> detected;      // blobs holding at least one seed; blobs - detected are missed
+};
+
+// n fractions evenly spaced in (0, 1)
+inline std::vector<double> sweepFractions(int n)
+{
+    std::vector<double> f(std::max(1, n));
+    for (size_t i = 0; i < f.size(); ++i) f[i] = (i + 1.0) / (f.size() + 1.0);
+    return f;
+}
+
+// opening: 0/255 mask (read through simd::firstPlane()); dist: CV_32FC1
+inline FractionSweep sweepThresholdFractions(const cv::Mat& opening, const cv::Mat& dist, std::vector<double> fractions)
+{
+    CV_Assert(dist.type() == CV_32FC1 && opening.size() == dist.size() && !fractions.empty());
+    std::sort(fractions.begin(), fractions.end());
+    const int k = static_cast<int>(fractions.size());
+    const int rows = dist.rows, cols = dist.cols, n = rows * cols;
+
+    double maxDist = 0.0;
+    cv::minMaxLoc(dist, nullptr, &maxDist);
+    std::vector<float> level(k);  // descending thresholds; step j = fractions[k - 1 - j]
+    for (int j = 0; j < k; ++j) level[j] = static_cast<float>(fractions[k - 1 - j] * maxDist);
+
+    // Step at which each pixel joins (k = never), bucketed by step
+    cv::Mat stepBuf = matPool().acquire(rows, cols, CV_32SC1);
+    parallelRows(rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const float* d = dist.ptr<float>(y);
+            int* s = stepBuf.ptr<int>(y);
+            for (int x = 0; x < cols; ++x) {
+                // First j with d > level[j]; level is descending
+                int lo = 0, hi = k;
+                while (lo < hi) {
+                    int mid = (lo + hi) / 2;
+                    if (d[x] > level[mid]) hi = mid;
+                    else lo = mid + 1;
+                }
+                s[x] = lo;
+            }
+        }
+    });
+
+    const int* step = stepBuf.ptr<int>(0);
+    std::vector<int> start(k + 2, 0);
+    for (int p = 0; p < n; ++p) ++start[step[p] + 1];
+    for (int j = 0; j <= k; ++j) start[j + 1] += start[j];
+    cv::Mat orderBuf = matPool().acquire(1, std::max(1, start[k]), CV_32SC1);
+    int* order = orderBuf.ptr<int>(0);
+    {
+        std::vector<int> fill(start.begin(), start.end() - 1);
+        for (int p = 0; p < n; ++p)
+            if (step[p] < k) order[fill[step[p]]++] = p;
+    }
+
+    // Union-find with the root of a set always its smallest pixel index
+    cv::Mat parentBuf = matPool().acquire(rows, cols, CV_32SC1);
+    int* parent = parentBuf.ptr<int>(0);
+    std::fill(parent, parent + n, -1);
+    auto find = [&](int p) {
+        while (parent[p] != p) {
+            parent[p] = parent[parent[p]];
+            p = parent[p];
+        }
+        return p;
+    };
+
+    FractionSweep result;
+    result.fractions = fractions;
+    result.seeds.assign(k, 0);
+    int components = 0;
+    for (int j = 0; j < k; ++j) {
+        for (int i = start[j]; i < start[j + 1]; ++i) {
+            const int p = order[i], x = p % cols, y = p / cols;
+            parent[p] = p;
+            ++components;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    const int nx = x + dx, ny = y + dy;
+                    if ((!dx && !dy) || nx < 0 || nx >= cols || ny < 0 || ny >= rows) continue;
+                    const int q = ny * cols + nx;
+                    if (parent[q] < 0) continue;
+                    int a = find(p), b = find(q);
+                    if (a == b) continue;
+                    parent[std::max(a, b)] = std::min(a, b);
+                    --components;
+                }
+            }
+        }
+        result.seeds[k - 1 - j] = components;
+    }
+
+    // A blob is detected once its deepest pixel clears the threshold
+    cv::Mat mask = simd::firstPlane(opening);
+    cv::Mat blobLabels;
+    result.blobs = labelComponents(mask, blobLabels) - 1;
+    std::vector<float> peak(result.blobs + 1, 0.0f);
+    for (int y = 0; y < rows; ++y) {
+        const int* l = blobLabels.ptr<int>(y);
+        const float* d = dist.ptr<float>(y);
+        for (int x = 0; x < cols; ++x) peak[l[x]] = std::max(peak[l[x]], d[x]);
+    }
+    std::sort(peak.begin() + 1, peak.end());
+    result.detected.assign(k, 0);
+    for (int i = 0; i < k; ++i) {
+        const float t = static_cast<float>(fractions[i] * maxDist);
+        result.detected[i] = static_cast<int>(peak.end() - std::upper_bound(peak.begin() + 1, peak.end(), t));
+    }
+    return result;
+}
+
+// ---------------------------------- //
+// -------- ^FRACTION SWEEP^ -------- //
+// ---------------------------------- //
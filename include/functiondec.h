@@ -1,3 +1,5 @@
+#pragma once
+
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
@@ -5,9 +7,26 @@
 #include <map>
 #include <set>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <vector>
+#include <queue>
 #include <iostream>
 
+#include "bitmask.h"
+#include "fractionsweep.h"
+#include "labeling.h"
+#include "labelruns.h"
+#include "localthreshold.h"
+#include "maxtree.h"
+#include "matpool.h"
+#include "morphology.h"
+#include "pixelkernels.h"
+#include "priorityflood.h"
+#include "recursiveblur.h"
+#include "simdkernels.h"
+#include "tileoccupancy.h"
+
 using namespace cv;
 
 
@@ -15,11 +34,14 @@ using namespace cv;
 // --------- PRE-PROCESSING --------- //
 // ---------------------------------- //
 
+// Every image is kept in OpenCV's BGR order from imread to imwrite. Nothing
+// here swaps channels; the texture upload reads BGR directly (GL_BGR).
+
 cv::Mat showBlueChannelOnly(const cv::Mat& imgOriginal)
 {
     // BGR
 
-    cv::Mat img = imgOriginal.clone();
+    const cv::Mat& img = imgOriginal;
     //cv::Mat img8bit;
 
     /**
@@ -38,24 +60,14 @@ cv::Mat showBlueChannelOnly(const cv::Mat& imgOriginal)
 
     //cv::imshow("img", img);
 
-    std::vector<cv::Mat> channels(3);
-    cv::split(img, channels);  // B, G, R
-
-    //DEBUG
-    //double minVal, maxVal;
-    //cv::minMaxLoc(channels[0], &minVal, &maxVal);
-    //std::cout << "Blue channel stats: min=" << minVal << ", max=" << maxVal << std::endl;
-
-    channels[1] = cv::Mat::zeros(channels[1].size(), channels[1].type()); // Zero G
-    channels[2] = cv::Mat::zeros(channels[2].size(), channels[2].type()); // Zero R
-
-    cv::Mat blueOnly;
-    cv::merge(channels, blueOnly);
+    // Keep B, zero G and R; same result as split/zero/merge in one pass
+    cv::Mat blueOnly = matPool().acquire(img.size(), img.type());
+    blueOnly.setTo(cv::Scalar::all(0));
+    int fromTo[] = { 0, 0 };
+    cv::mixChannels(&img, 1, &blueOnly, 1, fromTo, 1);
 
     //cv::imshow("Non-OpenGL", blueOnly);
 
-    cv::cvtColor(blueOnly, blueOnly, cv::COLOR_BGR2RGB); // Convert for OpenGL
-
     return blueOnly;
     
 
@@ -77,40 +89,114 @@ cv::Mat showBlueChannelOnly(const cv::Mat& imgOriginal)
 
 Mat toGrayscale(const Mat& img)
 {
-    Mat grayscale = img.clone();
-    Mat gray3ch;
-
-    cvtColor(img, grayscale, COLOR_RGB2GRAY);
-    cvtColor(grayscale, gray3ch, COLOR_GRAY2RGB);  // Make it 3-channel again
-    return gray3ch;
+    Mat grayscale = matPool().acquire(img.size(), CV_MAKETYPE(img.depth(), 1));
+    Mat gray3ch = matPool().acquire(img.size(), CV_MAKETYPE(img.depth(), 3));
 
+    simd::bgrToGray(img, grayscale);
+    cvtColor(grayscale, gray3ch, COLOR_GRAY2BGR);  // Make it 3-channel again
     return gray3ch;
 }
 
 
-Mat gaussianFilter(const Mat& img)
+// BLUR_RECURSIVE costs the same for any sigma (include/recursiveblur.h);
+// use it when the background needs a wide blur
+enum BlurMode {
+    BLUR_GAUSSIAN  = 0,
+    BLUR_RECURSIVE = 1,
+};
+
+Mat gaussianFilter(const Mat& img, double sigma = 3.0, int mode = BLUR_GAUSSIAN)
 {
-    Mat blurredImg = img.clone();
+    Mat blurredImg = matPool().acquire(img.size(), img.type());
 
-    GaussianBlur(img, blurredImg, Size(0, 0), 3.0);
-    cv::cvtColor(blurredImg, blurredImg, cv::COLOR_BGR2RGB); // Convert for OpenGL
+    if (mode == BLUR_RECURSIVE)
+        recursiveGaussianBlur(img, blurredImg, sigma);
+    else
+        GaussianBlur(img, blurredImg, Size(0, 0), sigma);
 
     return blurredImg;
 }
 
 
-Mat intensityThreshold(const Mat& img)
+// Removes slowly varying illumination before thresholding. Both methods
+// estimate the background on a copy shrunk by up to 8x (as ImageJ's rolling
+// ball does), so the cost stays close to linear in the pixel count:
+//  - BACKGROUND_TOPHAT: opening with a disk of `radius` (rolling-ball-like);
+//    the shrink takes block minima so the estimate stays under the signal
+//  - BACKGROUND_BLUR: Gaussian of sigma `radius` (recursive, any radius)
+enum BackgroundMethod {
+    BACKGROUND_NONE   = 0,
+    BACKGROUND_TOPHAT = 1,
+    BACKGROUND_BLUR   = 2,
+};
+
+int backgroundShrink(int radius)
+{
+    return radius <= 10 ? 1 : radius <= 30 ? 2 : radius <= 100 ? 4 : 8;
+}
+
+Mat subtractBackground(const Mat& img, int method = BACKGROUND_TOPHAT, int radius = 50)
 {
-    Mat gray, binary, binary3ch;
+    if (method == BACKGROUND_NONE || radius <= 0) return img;
+
+    const int shrink = backgroundShrink(radius);
+    const Size smallSize(std::max(1, img.cols / shrink), std::max(1, img.rows / shrink));
+    Mat small = img;
+    if (shrink > 1) {
+        small = matPool().acquire(smallSize, img.type());
+        if (method == BACKGROUND_TOPHAT) {
+            Mat blockMin;
+            fastMorphology(img, blockMin, MORPH_ERODE, MORPH_RECT, Size(shrink, shrink));
+            resize(blockMin, small, smallSize, 0, 0, INTER_NEAREST);
+        } else {
+            resize(img, small, smallSize, 0, 0, INTER_AREA);
+        }
+    }
 
-    if (img.channels() == 3)
-        cvtColor(img, gray, COLOR_BGR2GRAY);
+    const int smallRadius = std::max(1, radius / shrink);
+    Mat background = matPool().acquire(smallSize, img.type());
+    if (method == BACKGROUND_TOPHAT)
+        fastMorphology(small, background, MORPH_OPEN, MORPH_ELLIPSE, Size(2 * smallRadius + 1, 2 * smallRadius + 1));
     else
+        recursiveGaussianBlur(small, background, static_cast<double>(radius) / shrink);
+
+    if (shrink > 1) {
+        Mat full = matPool().acquire(img.size(), img.type());
+        resize(background, full, img.size(), 0, 0, INTER_LINEAR);
+        background = full;
+    }
+
+    Mat corrected = matPool().acquire(img.size(), img.type());
+    subtract(img, background, corrected);  // saturates at 0
+    return corrected;
+}
+
+
+// thresholdOverride < 0 picks the level with Otsu. A local method
+// (include/localthreshold.h) replaces the global level entirely.
+Mat intensityThreshold(const Mat& img, double thresholdOverride = -1.0, const LocalThreshold& local = LocalThreshold())
+{
+    Mat gray;
+    if (img.channels() == 3) {
+        gray = matPool().acquire(img.size(), CV_MAKETYPE(img.depth(), 1));
+        simd::bgrToGray(img, gray);
+    } else {
         gray = img;
+    }
+
+    Mat binary = matPool().acquire(gray.size(), gray.type());
+    Mat binary3ch = matPool().acquire(gray.size(), CV_MAKETYPE(gray.depth(), 3));
 
-    threshold(gray, binary, 0, 255, THRESH_BINARY | THRESH_OTSU);
+    if (local.method != LOCAL_THRESH_NONE)
+        localThreshold(gray, binary, local);
+    else if (thresholdOverride < 0)
+        threshold(gray, binary, 0, 255, THRESH_BINARY | THRESH_OTSU);
+    else if (gray.type() == CV_8UC1)
+        simd::thresholdBinary(gray, binary, thresholdOverride);
+    else
+        threshold(gray, binary, thresholdOverride, 255, THRESH_BINARY);
 
-    cvtColor(binary, binary3ch, COLOR_GRAY2RGB);  // Make it 3-channel again
+    cvtColor(binary, binary3ch, COLOR_GRAY2BGR);  // Make it 3-channel again
     return binary3ch;
 }
 
@@ -125,169 +211,206 @@ Mat intensityThreshold(const Mat& img)
 // ----------- WATERSHED ------------ //
 // ---------------------------------- //
 
+// Markers (16-bit when the labels fit) and the region count. No colourized
+// image: colorizeMarkers() builds one when a result is shown or saved.
 struct WatershedOutput {
-    cv::Mat watershedOutImg;
-    int count;
+    int count = 0;
     cv::Mat markers;
 };
 
-// ---------- OpenCV ------------- //
+// Tunables shared by all engines; the defaults differ per engine
+struct WatershedParams {
+    int openIterations = 2;
+    int dilateIterations = 3;
+    double thresholdFraction = 0.4;  // of the max distance-transform value
+    int closingKernel = 0;           // ellipse size for closing sure foreground, 0 = off
+    int minObjectArea = 0;           // area opening of the mask before the 3x3 opening, 0 = off
+};
 
-WatershedOutput runWatershed(const cv::Mat& originalImg) 
+WatershedParams customWatershedDefaults()
 {
-    using namespace cv;
-
-    Mat img = originalImg.clone();
-    cvtColor(img, img, COLOR_RGB2GRAY);
-
-    // Noise removal with morphological opening
-    Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
-    Mat opening;
-    morphologyEx(img, opening, MORPH_OPEN, kernel, Point(-1, -1), 2);
-
-    // Sure background area (dilated)
-    Mat sureBg;
-    dilate(opening, sureBg, kernel, Point(-1, -1), 3);
-
-    // Sure foreground area using distance transform
-    Mat distTransform;
-    distanceTransform(opening, distTransform, DIST_L2, 5);
-    Mat sureFg;
-    double minVal, maxVal;
-    minMaxLoc(distTransform, &minVal, &maxVal);
-    threshold(distTransform, sureFg, 0.4 * maxVal, 255, 0);
-    sureFg.convertTo(sureFg, CV_8U);
-
-    // Unknown region = background - foreground
-    Mat unknown;
-    subtract(sureBg, sureFg, unknown);
-
-    // Label markers
-    Mat markers;
-    connectedComponents(sureFg, markers);
-    markers += 1; // make sure background is not 0
-    markers.setTo(0, unknown); // mark unknown as 0
-
-    // Prepare input for watershed (needs 3 channels)
-    Mat colorImg;
-    if (img.channels() == 1)
-        cvtColor(img, colorImg, COLOR_GRAY2BGR);
-    else
-        colorImg = img.clone();
-
-    // Apply watershed
-    watershed(colorImg, markers);
-
-    // Generate output image
-    Mat output = Mat::zeros(markers.size(), CV_8UC3);
-    int count = 0;
-    std::map<int, Vec3b> colorMap;
-
-    std::set<int> objectLabels;
-    for (int r = 0; r < markers.rows; ++r) {
-        for (int c = 0; c < markers.cols; ++c) {
-            int label = markers.at<int>(r, c);
-            if (label == -1) {
-                output.at<Vec3b>(r, c) = Vec3b(255, 255, 255); // boundary
-            }
-            else if (label > 1) {
-                objectLabels.insert(label);
-                if (colorMap.find(label) == colorMap.end()) {
-                    colorMap[label] = Vec3b(rand() % 256, rand() % 256, rand() % 256);
-                    count++;
-                }
-                output.at<Vec3b>(r, c) = colorMap[label];
-            }
-        }
-    }
+    WatershedParams params;
+    params.dilateIterations = 0;
+    params.thresholdFraction = 0.1;
+    params.closingKernel = 7;
+    return params;
+}
 
-    /*
-    // feature extraction
-    for (int label : objectLabels) {
-        Mat singleObjMask = (markers == label);
+// Each 3x3 iteration grows the structuring element by one pixel, so the
+// count scales with the image; keep at least one if any was asked for
+inline int scaledIterations(int iterations, double scale)
+{
+    if (iterations <= 0) return 0;
+    return std::max(1, static_cast<int>(std::lround(iterations * scale)));
+}
 
-        std::vector<std::vector<Point>> contours;
-        findContours(singleObjMask, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
-        if (contours.empty()) continue;
+inline int scaledKernel(int size, double scale)
+{
+    if (size <= 0) return 0;
+    int k = static_cast<int>(std::lround(size * scale));
+    return std::max(3, k | 1);
+}
 
-        Rect bbox = boundingRect(contours[0]);
+// The same segmentation on an image resized by `scale`
+WatershedParams scaledWatershedParams(const WatershedParams& params, double scale)
+{
+    WatershedParams scaled = params;
+    scaled.openIterations = scaledIterations(params.openIterations, scale);
+    scaled.dilateIterations = scaledIterations(params.dilateIterations, scale);
+    scaled.closingKernel = scaledKernel(params.closingKernel, scale);
+    scaled.minObjectArea = static_cast<int>(std::lround(params.minObjectArea * scale * scale));
+    return scaled;
+}
 
-        Moments m = moments(contours[0]);
-        Point2f centroid(m.m10 / m.m00, m.m01 / m.m00);
+// ---------- Shared steps ---------- //
+
+// All engines run the same marker preparation and differ only in how the
+// unknown region is flooded. The steps are separate so a pipeline can keep
+// each intermediate and recompute only what a parameter change affects.
+
+// `occupancy` (include/tileoccupancy.h) marks the tiles of the thresholded
+// image that hold any foreground; the engines compute it once and pass it
+// to every step. Steps given none compute their own. The opening and the
+// distance threshold only remove foreground, so their input stays inside
+// the threshold's occupied tiles. The sure-foreground closing does add
+// foreground, but only within its kernel size of existing foreground; that
+// size is its margin, and regions grow by whole tiles to cover the margin,
+// so every pixel it adds still falls inside a processed region.
+
+// Input is the thresholded 0/255 image, so both morphology steps run on the
+// bit-packed mask (include/bitmask.h)
+Mat watershedOpening(const Mat& binaryImg, int iterations, int minObjectArea = 0,
+                     const TileOccupancy* occupancy = nullptr)
+{
+    // Debris below minObjectArea pixels is removed whole by an area opening
+    // (include/maxtree.h), which leaves the outlines of real nuclei alone;
+    // the 3x3 opening then only has to smooth edges. Components never cross
+    // empty tiles, so the tree is only built over the occupied regions.
+    Mat cleaned = binaryImg;
+    if (minObjectArea > 0) {
+        const TileOccupancy own = occupancy ? TileOccupancy() : TileOccupancy(binaryImg);
+        cleaned = matPool().acquire(binaryImg.size(), binaryImg.type());
+        forEachOccupiedRegion(occupancy ? *occupancy : own, 1, binaryImg, cleaned, [&](const Mat& src, Mat& dst) {
+            Mat filtered;
+            areaOpening(src, filtered, minObjectArea);
+            filtered.copyTo(dst);
+        });
     }
-    **/
-
-    cvtColor(output, output, COLOR_BGR2RGB);
 
-    return { output, count, markers };
+    // Noise removal with morphological opening
+    BitMask mask = openRect(BitMask::pack(cleaned), Size(3, 3), iterations);
+    Mat opening = matPool().acquire(binaryImg.size(), CV_8UC1);
+    mask.unpack(opening);
+    return opening;
 }
 
-// ---------- Custom ---------- //
-
-WatershedOutput runCustomWatershed(const cv::Mat& originalImg) 
+Mat watershedSureBackground(const Mat& opening, int dilateIterations)
 {
-    using namespace cv;
-    
-    Mat grayImg;
-    cvtColor(originalImg, grayImg, COLOR_RGB2GRAY);
-
-
-    cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
-    cv::Mat opening;
-    morphologyEx(grayImg, opening, MORPH_OPEN, kernel, Point(-1, -1), 2);
-
-
-    int dilationNum = 0;
-    Mat sureBg;
-    dilate(opening, sureBg, kernel, Point(-1,-1), dilationNum);
+    BitMask mask = dilateRect(BitMask::pack(opening), Size(3, 3), dilateIterations);
+    Mat sureBg = matPool().acquire(opening.size(), CV_8UC1);
+    mask.unpack(sureBg);
+    return sureBg;
+}
 
+// Background pixels are 0 and every region is framed by background, so the
+// transform runs per occupied region (3 pixels of margin cover the 5x5
+// mask's reach) and empty tiles are zero-filled
+Mat watershedDistance(const Mat& opening, const TileOccupancy* occupancy = nullptr)
+{
+    const TileOccupancy own = occupancy ? TileOccupancy() : TileOccupancy(opening);
+    Mat distTransform = matPool().acquire(opening.size(), CV_32FC1);
+    forEachOccupiedRegion(occupancy ? *occupancy : own, 3, opening, distTransform, [](const Mat& src, Mat& dst) {
+        distanceTransform(src, dst, DIST_L2, 5);
+    });
+    return distTransform;
+}
 
-    Mat distTransform;
-    int distType = DIST_L2;
-    int maskSize = 5;
-    distanceTransform(opening, distTransform, distType, maskSize);
-    
-    Mat sureFg;
+Mat watershedSureForeground(const Mat& distTransform, double thresholdFraction, int closingKernelSize,
+                            const TileOccupancy* occupancy = nullptr)
+{
     double maxDistance = 0.0;
     minMaxLoc(distTransform, nullptr, &maxDistance);
 
-    double thresholdFraction = 0.1;
-    double thresholdValue = thresholdFraction * maxDistance;
-    double maxBinaryValue = 255.0;
-    threshold(distTransform, sureFg, thresholdValue, maxBinaryValue, THRESH_BINARY);
-
-    sureFg.convertTo(sureFg, CV_8U);
-
-    Mat closingKernel = getStructuringElement(MORPH_ELLIPSE, Size(7, 7)); 
-    morphologyEx(sureFg, sureFg, MORPH_CLOSE, closingKernel, Point(-1,-1), 1);
+    Mat sureFgFloat = matPool().acquire(distTransform.size(), CV_32FC1);
+    threshold(distTransform, sureFgFloat, thresholdFraction * maxDistance, 255.0, THRESH_BINARY);
+    Mat sureFg = matPool().acquire(distTransform.size(), CV_8UC1);
+    sureFgFloat.convertTo(sureFg, CV_8U);
+
+    // Large kernels switch to the octagon decomposition (include/morphology.h).
+    // A closing reaches no further than its kernel, so that is the margin.
+    if (closingKernelSize > 0) {
+        const TileOccupancy own = occupancy ? TileOccupancy() : TileOccupancy(sureFg);
+        Mat closed = matPool().acquire(sureFg.size(), CV_8UC1);
+        forEachOccupiedRegion(occupancy ? *occupancy : own, closingKernelSize, sureFg, closed, [&](const Mat& src, Mat& dst) {
+            Mat out;
+            fastMorphology(src, out, MORPH_CLOSE, MORPH_ELLIPSE, Size(closingKernelSize, closingKernelSize));
+            out.copyTo(dst);
+        });
+        sureFg = closed;
+    }
+    return sureFg;
+}
 
-    Mat unknown;
+// Seeds labelled from 2 up; 1 = sure background, 0 = unknown (to be flooded).
+// `seedStats` (optional) gets the area, bounding box and centroid of every
+// seed from the labeling pass itself: entry i is label i + 1.
+Mat watershedSeedMarkers(const Mat& sureBg, const Mat& sureFg, std::vector<ComponentStats>* seedStats = nullptr)
+{
+    // Unknown region = background - foreground
+    Mat unknown = matPool().acquire(sureBg.size(), CV_8UC1);
     subtract(sureBg, sureFg, unknown);
 
-
-    Mat markers;
-    connectedComponents(sureFg, markers);
-    markers += 1; // make background 1 instead of 0
+    // Offset 1 makes the background 1 instead of 0 in the same pass
+    Mat markers = matPool().acquire(sureFg.size(), CV_32SC1);
+    labelComponents(sureFg, markers, 8, seedStats, 1);
     markers.setTo(0, unknown);
+    return markers;
+}
 
+// OpenCV's watershed needs a 3-channel image
+void floodOpenCV(const Mat& binaryImg, Mat& markers)
+{
+    Mat grayImg;
+    if (binaryImg.channels() == 3) {
+        grayImg = matPool().acquire(binaryImg.size(), CV_8UC1);
+        simd::extractChannel(binaryImg, grayImg, 0);  // B == G == R in a binary mask
+    } else {
+        grayImg = binaryImg;
+    }
+    Mat colorImg = matPool().acquire(binaryImg.size(), CV_8UC3);
+    cvtColor(grayImg, colorImg, COLOR_GRAY2BGR);
 
+    watershed(colorImg, markers);
+}
 
+// Grows every seed into the unknown region breadth-first; pixels where two
+// regions meet become -1 boundaries
+void floodBFS(Mat& markers)
+{
     // Initialize visited map and BFS queue
-    Mat visited = Mat::zeros(markers.size(), CV_8U);
+    Mat visited = matPool().acquire(markers.size(), CV_8U);
+    visited.setTo(Scalar::all(0));
     std::queue<Point> bfsQueue;
 
     const int rows = markers.rows;
     const int cols = markers.cols;
 
+    // Only seed pixels touching an unknown (or boundary) pixel can change
+    // anything, so only those are queued; a mostly labelled image (e.g. the
+    // coarse-to-fine refinement) then floods just its unknown band
     for (int y = 0; y < rows; ++y) {
+        const int* markerRow = markers.ptr<int>(y);
+        const int* above = y > 0 ? markers.ptr<int>(y - 1) : nullptr;
+        const int* below = y < rows - 1 ? markers.ptr<int>(y + 1) : nullptr;
+        uchar* visitedRow = visited.ptr<uchar>(y);
         for (int x = 0; x < cols; ++x) {
-            int markerValue = markers.at<int>(y, x);
-            bool isLabeledRegion = markerValue > 1;
+            bool isLabeledRegion = markerRow[x] > 1;
+            if (!isLabeledRegion) continue;
 
-            if (isLabeledRegion) {
+            visitedRow[x] = 1;
+            if ((x > 0 && markerRow[x - 1] <= 0) || (x < cols - 1 && markerRow[x + 1] <= 0) ||
+                (above && above[x] <= 0) || (below && below[x] <= 0))
                 bfsQueue.push(Point(x, y));
-                visited.at<uchar>(y, x) = 1;
-            }
         }
     }
 
@@ -302,7 +425,8 @@ WatershedOutput runCustomWatershed(const cv::Mat& originalImg)
         Point current = bfsQueue.front();
         bfsQueue.pop();
 
-        int currentLabel = markers.at<int>(current);
+        int& currentMarker = markers.ptr<int>(current.y)[current.x];
+        int currentLabel = currentMarker;
 
         for (const auto& dir : directions) {
             Point neighbor = current + dir;
@@ -311,8 +435,8 @@ WatershedOutput runCustomWatershed(const cv::Mat& originalImg)
             if (neighbor.x < 0 || neighbor.x >= cols || neighbor.y < 0 || neighbor.y >= rows)
                 continue;
 
-            uchar& visitedFlag = visited.at<uchar>(neighbor);
-            int& neighborLabel = markers.at<int>(neighbor);
+            uchar& visitedFlag = visited.ptr<uchar>(neighbor.y)[neighbor.x];
+            int& neighborLabel = markers.ptr<int>(neighbor.y)[neighbor.x];
 
             if (!visitedFlag) {
                 if (neighborLabel == 0) {
@@ -322,47 +446,308 @@ WatershedOutput runCustomWatershed(const cv::Mat& originalImg)
                     bfsQueue.push(neighbor);
                 } else if (neighborLabel != currentLabel && neighborLabel != 1) {
                     // Conflict: adjacent to a different region (not background)
-                    markers.at<int>(current) = -1; // mark as boundary
+                    currentMarker = -1; // mark as boundary
                 }
             }
         }
     }
+}
 
+// Grows every seed in the order the water reaches the unknown pixels on
+// `landscape` (highest values first), so regions meet on the valleys between
+// them. The landscape is the distance transform or the blurred intensity;
+// see include/priorityflood.h. Linear in the pixel count.
+void floodPriority(const Mat& landscape, Mat& markers)
+{
+    priorityFlood(landscape, markers);
+}
 
-    //splitLargeRegions(markers);
-
+// ---------- Region splitting ---------- //
 
-    Mat output(markers.size(), CV_8UC3, Scalar(0, 0, 0));
+struct SplitParams {
+    double madFactor = 3.0;          // outlier: area > median + madFactor * MAD (normal-scaled); 0 = off
+    double thresholdFraction = 0.5;  // seeds above this fraction of the region's own max distance
+};
 
-    std::map<int, Vec3b> labelToColor;
-    int regionCount = 0;
+// Re-segments only the regions whose area is an outlier among all regions
+// (typically two or more nuclei flooded from one seed). Each runs inside its
+// own bounding box: distance transform of the region alone, seeds at a
+// finer fraction of its own peak, priority flood down that distance. The
+// regions are independent, so they are split in parallel; the first part
+// keeps the original label and the others get new labels above the current
+// maximum, in region order. Returns the number of regions split.
+int splitLargeRegions(Mat& markers, const SplitParams& params = SplitParams())
+{
+    CV_Assert(markers.type() == CV_32SC1);
+    if (params.madFactor <= 0) return 0;
+
+    std::vector<ComponentStats> stats = labelStats(markers);
+    std::vector<int> labels;
+    std::vector<double> areas;
+    for (int label = 2; label < static_cast<int>(stats.size()); ++label) {
+        if (!stats[label].area) continue;
+        labels.push_back(label);
+        areas.push_back(stats[label].area);
+    }
+    if (labels.size() < 5) return 0;  // too few regions to call one an outlier
 
-    for (int y = 0; y < markers.rows; ++y) {
-        for (int x = 0; x < markers.cols; ++x) {
-            int label = markers.at<int>(y, x);
-            Vec3b& pixel = output.at<Vec3b>(y, x);
+    auto median = [](std::vector<double> v) {
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        return v[v.size() / 2];
+    };
+    const double medianArea = median(areas);
+    std::vector<double> deviations;
+    for (double a : areas) deviations.push_back(std::abs(a - medianArea));
+    const double limit = medianArea + params.madFactor * 1.4826 * median(deviations);
+
+    std::vector<int> large;
+    for (size_t i = 0; i < labels.size(); ++i)
+        if (areas[i] > limit && areas[i] > medianArea) large.push_back(labels[i]);
+    if (large.empty()) return 0;
+
+    // Local markers, one pixel of padding so the box edge counts as outside:
+    // parts from 2, -1 = not this region (never flooded)
+    std::vector<Mat> parts(large.size());
+    std::vector<int> partCount(large.size(), 0);
+    parallel_for_(Range(0, static_cast<int>(large.size())), [&](const Range& r) {
+        for (int i = r.start; i < r.end; ++i) {
+            const Rect roi = stats[large[i]].bbox();
+            Mat mask, padded;
+            compare(markers(roi), large[i], mask, CMP_EQ);
+            copyMakeBorder(mask, padded, 1, 1, 1, 1, BORDER_CONSTANT, Scalar::all(0));
+
+            Mat dist;
+            distanceTransform(padded, dist, DIST_L2, 5);
+            double peak = 0.0;
+            minMaxLoc(dist, nullptr, &peak);
+            Mat seeds;
+            threshold(dist, seeds, params.thresholdFraction * peak, 255.0, THRESH_BINARY);
+            seeds.convertTo(seeds, CV_8U);
+
+            Mat local;
+            int count = labelComponents(seeds, local, 8, nullptr, 1) - 1;
+            if (count < 2) continue;
+            local.setTo(-1, padded == 0);
+            local.setTo(0, local == 1);
+            priorityFlood(dist, local);
+            parts[i] = local;
+            partCount[i] = count;
+        }
+    });
+
+    int next = maxLabel(markers) + 1;
+    std::vector<int> firstNew(large.size());
+    int split = 0;
+    for (size_t i = 0; i < large.size(); ++i) {
+        firstNew[i] = next;
+        if (partCount[i] > 1) {
+            next += partCount[i] - 1;
+            ++split;
+        }
+    }
 
-            if (label == -1) {
-                // Boundary between regions
-                pixel = Vec3b(255, 255, 255);
-            } else if (label > 1) {
-                // Assign a random color if this label hasn't been seen yet
-                if (labelToColor.find(label) == labelToColor.end()) {
-                    Vec3b randomColor(rand() % 256, rand() % 256, rand() % 256);
-                    labelToColor[label] = randomColor;
-                    regionCount++;
+    // Regions own disjoint pixels, so the write-back is parallel too
+    parallel_for_(Range(0, static_cast<int>(large.size())), [&](const Range& r) {
+        for (int i = r.start; i < r.end; ++i) {
+            if (partCount[i] < 2) continue;
+            const Rect roi = stats[large[i]].bbox();
+            for (int y = 0; y < roi.height; ++y) {
+                int* m = markers.ptr<int>(roi.y + y) + roi.x;
+                const int* p = parts[i].ptr<int>(y + 1) + 1;
+                for (int x = 0; x < roi.width; ++x) {
+                    if (m[x] != large[i]) continue;
+                    if (p[x] == -1) m[x] = -1;
+                    else if (p[x] > 2) m[x] = firstNew[i] + p[x] - 3;
                 }
-                pixel = labelToColor[label];
             }
         }
+    });
+    return split;
+}
+
+// Finished segmentation: counts the regions, compacts the markers
+WatershedOutput finishMarkers(const Mat& markers)
+{
+    // Kept past this run (history, cache), so stored at 16 bits when possible
+    return { static_cast<int>(collectLabels(markers).size()), compactMarkers(markers) };
+}
+
+// Colour of every label in `labels` (sorted), indexed by label. The colour
+// is a hash of the label, so a segmentation looks the same every time it is
+// drawn. 0 (unknown) and 1 (background) stay black.
+std::vector<Vec3b> labelColours(const std::vector<int>& labels)
+{
+    std::vector<Vec3b> labelToColor(labels.empty() ? 2 : labels.back() + 1, Vec3b(0, 0, 0));
+    for (int label : labels) {
+        uint32_t h = static_cast<uint32_t>(label) * 2654435761u;
+        h ^= h >> 13;
+        labelToColor[label] = Vec3b(h & 255, (h >> 8) & 255, (h >> 16) & 255);
     }
+    return labelToColor;
+}
+
+// Colour per region (labelColours), white boundaries
+Mat colorizeMarkers(const Mat& markers)
+{
+    Mat output = matPool().acquire(markers.size(), CV_8UC3);
+    fillFromLabels(markers, output, labelColours(collectLabels(markers)), Vec3b(255, 255, 255));
+    return output;
+}
+
+// ---------- Fraction sweep ---------- //
+
+// Raw seed counts and detected blobs for every fraction, from one opening
+// and one distance transform. closingKernel and splitLargeRegions are not
+// applied: the sweep counts the raw sure-foreground components (see
+// fractionsweep.h).
+FractionSweep sweepWatershedFractions(const cv::Mat& originalImg, const std::vector<double>& fractions,
+                                      const WatershedParams& params = customWatershedDefaults())
+{
+    Mat opening = watershedOpening(originalImg, params.openIterations, params.minObjectArea);
+    Mat distTransform = watershedDistance(opening);
+    return sweepThresholdFractions(opening, distTransform, fractions);
+}
+
+// ---------- OpenCV ------------- //
+
+WatershedOutput runWatershed(const cv::Mat& originalImg, const WatershedParams& params = WatershedParams())
+{
+    TileOccupancy occupancy(originalImg);
+    Mat opening = watershedOpening(originalImg, params.openIterations, params.minObjectArea, &occupancy);
+    Mat sureBg = watershedSureBackground(opening, params.dilateIterations);
+    Mat distTransform = watershedDistance(opening, &occupancy);
+    Mat sureFg = watershedSureForeground(distTransform, params.thresholdFraction, params.closingKernel, &occupancy);
+    Mat markers = watershedSeedMarkers(sureBg, sureFg);
+
+    floodOpenCV(originalImg, markers);
+
+    return finishMarkers(markers);
+}
+
+// ---------- Custom ---------- //
+
+WatershedOutput runCustomWatershed(const cv::Mat& originalImg, const WatershedParams& params = customWatershedDefaults())
+{
+    TileOccupancy occupancy(originalImg);
+    Mat opening = watershedOpening(originalImg, params.openIterations, params.minObjectArea, &occupancy);
+    Mat sureBg = watershedSureBackground(opening, params.dilateIterations);
+    Mat distTransform = watershedDistance(opening, &occupancy);
+    Mat sureFg = watershedSureForeground(distTransform, params.thresholdFraction, params.closingKernel, &occupancy);
+    Mat markers = watershedSeedMarkers(sureBg, sureFg);
+
+    floodBFS(markers);
+
+    splitLargeRegions(markers);
+
+    return finishMarkers(markers);
+}
+
+// ---------- Priority ---------- //
+
+// Custom engine's marker preparation, flooded down the distance transform
+WatershedOutput runPriorityWatershed(const cv::Mat& originalImg, const WatershedParams& params = customWatershedDefaults())
+{
+    TileOccupancy occupancy(originalImg);
+    Mat opening = watershedOpening(originalImg, params.openIterations, params.minObjectArea, &occupancy);
+    Mat sureBg = watershedSureBackground(opening, params.dilateIterations);
+    Mat distTransform = watershedDistance(opening, &occupancy);
+    Mat sureFg = watershedSureForeground(distTransform, params.thresholdFraction, params.closingKernel, &occupancy);
+    Mat markers = watershedSeedMarkers(sureBg, sureFg);
+
+    floodPriority(distTransform, markers);
+
+    return finishMarkers(markers);
+}
 
+// ---------- Coarse-to-fine ---------- //
+
+// Custom engine at 1/factor scale, refined at full resolution only where it
+// matters. The coarse result is upsampled; a band one coarse pixel wide on
+// either side of every label change (object/object, object/background) is
+// reset to unknown and re-flooded from the upsampled interiors, inside the
+// full-resolution opening. Interiors and background cost one upsample, so
+// sparse frames run several times faster than runCustomWatershed while
+// object outlines (area, perimeter) come from the full-resolution mask.
+// Objects too small to keep an interior at coarse scale are upsampled as
+// they are; objects lost entirely at coarse scale (a few pixels across) are
+// not recovered.
+Mat coarseToFineMarkers(const cv::Mat& originalImg, const WatershedParams& params, int factor)
+{
+    const double scale = 1.0 / factor;
+    Mat small = matPool().acquire(Size(std::max(1, cvRound(originalImg.cols * scale)),
+                                       std::max(1, cvRound(originalImg.rows * scale))), originalImg.type());
+    resize(originalImg, small, small.size(), 0, 0, INTER_AREA);
+    threshold(small, small, 127, 255, THRESH_BINARY);
+
+    const WatershedParams coarseParams = scaledWatershedParams(params, scale);
+    Mat coarseOpening = watershedOpening(small, coarseParams.openIterations, coarseParams.minObjectArea);
+    Mat coarseBg = watershedSureBackground(coarseOpening, coarseParams.dilateIterations);
+    Mat coarseFg = watershedSureForeground(watershedDistance(coarseOpening), coarseParams.thresholdFraction, coarseParams.closingKernel);
+    Mat coarse = watershedSeedMarkers(coarseBg, coarseFg);
+    floodBFS(coarse);
+    splitLargeRegions(coarse);
+
+    // Band: coarse pixels with a differently labelled 8-neighbour
+    const int rows = coarse.rows, cols = coarse.cols;
+    Mat band = matPool().acquire(coarse.size(), CV_8UC1);
+    parallelRows(rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const int* m = coarse.ptr<int>(y);
+            uchar* b = band.ptr<uchar>(y);
+            for (int x = 0; x < cols; ++x) {
+                bool edge = false;
+                for (int dy = -1; dy <= 1 && !edge; ++dy) {
+                    if (y + dy < 0 || y + dy >= rows) continue;
+                    const int* n = coarse.ptr<int>(y + dy);
+                    for (int dx = -1; dx <= 1; ++dx)
+                        if (x + dx >= 0 && x + dx < cols && n[x + dx] != m[x]) { edge = true; break; }
+                }
+                b[x] = edge ? 255 : 0;
+            }
+        }
+    });
 
-    cvtColor(output, output, COLOR_BGR2RGB);
+    // A label with no pixel outside the band would lose its seed: keep it whole
+    std::vector<uchar> hasInterior(std::max(2, maxLabel(coarse) + 1), 0);
+    for (int y = 0; y < rows; ++y) {
+        const int* m = coarse.ptr<int>(y);
+        const uchar* b = band.ptr<uchar>(y);
+        for (int x = 0; x < cols; ++x)
+            if (m[x] > 1 && !b[x]) hasInterior[m[x]] = 1;
+    }
+    for (int y = 0; y < rows; ++y) {
+        const int* m = coarse.ptr<int>(y);
+        uchar* b = band.ptr<uchar>(y);
+        for (int x = 0; x < cols; ++x)
+            if (m[x] > 1 && !hasInterior[m[x]]) b[x] = 0;
+    }
 
-    return { output, regionCount, markers };
+    Mat opening = watershedOpening(originalImg, params.openIterations, params.minObjectArea);
+    Mat upLabels = matPool().acquire(originalImg.size(), CV_32SC1);
+    Mat upBand = matPool().acquire(originalImg.size(), CV_8UC1);
+    resize(coarse, upLabels, upLabels.size(), 0, 0, INTER_NEAREST);
+    resize(band, upBand, upBand.size(), 0, 0, INTER_NEAREST);
+
+    // Outside the opening: background. In the band (or where the coarse run
+    // saw background): unknown, to be flooded. Elsewhere: the coarse label.
+    parallelRows(upLabels.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uchar* o = opening.ptr<uchar>(y);
+            const uchar* b = upBand.ptr<uchar>(y);
+            int* m = upLabels.ptr<int>(y);
+            for (int x = 0; x < upLabels.cols; ++x)
+                m[x] = !o[x] ? 1 : (b[x] || m[x] <= 1) ? 0 : m[x];
+        }
+    });
+    floodBFS(upLabels);
+    return upLabels;
 }
 
+WatershedOutput runCoarseWatershed(const cv::Mat& originalImg, const WatershedParams& params = customWatershedDefaults(), int factor = 4)
+{
+    if (factor <= 1) return runCustomWatershed(originalImg, params);
+    return finishMarkers(coarseToFineMarkers(originalImg, params, factor));
+}
 // ---------------------------------- //
 // ---------- ^WATERSHED^ ----------- //
 // ---------------------------------- //
@@ -374,84 +759,61 @@ WatershedOutput runCustomWatershed(const cv::Mat& originalImg)
 // -------- other ANALYSIS ---------- //
 // ---------------------------------- //
 
-std::vector<double> calculateNSI(const cv::Mat& markersArg) {
+// NSI = 4 pi area / perimeter^2 per object, in label order. Each object's
+// mask is drawn from its runs inside its bounding box (plus a 1 pixel
+// margin), so the cost follows the objects' area, not labels x image, and
+// the objects are traced in parallel.
+std::vector<double> calculateNSI(const LabelRuns& objects) {
     using namespace cv;
 
-    Mat markers = markersArg.clone();
+    std::vector<ComponentStats> stats = objects.stats();
+    std::vector<double> nsis(objects.count(), 0.0);
+    const Rect frame(0, 0, objects.size().width, objects.size().height);
 
-    std::vector<double> nsis;
+    parallel_for_(Range(0, objects.count()), [&](const Range& range) {
+        Mat mask;
+        for (int i = range.start; i < range.end; ++i) {
+            const Rect box = stats[i].bbox();
+            const Rect roi = Rect(box.x - 1, box.y - 1, box.width + 2, box.height + 2) & frame;
+            objects.objectMask(i, roi, mask);
 
-    //DEBUGGING
-    //std::cout << "NSI FUNCTION RUNNING" << std::endl;
+            // Find contours for perimeter
+            std::vector<std::vector<Point>> contours;
+            findContours(mask, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
 
-    // Skip labels: 0 (unknown) and -1 (watershed boundary)
-    std::set<int> labels;
-    for (int r = 0; r < markers.rows; ++r) {
-        for (int c = 0; c < markers.cols; ++c) {
-            int label = markers.at<int>(r, c);
-            if (label > 1) {
-                labels.insert(label);
-            }
-        }
-    }
+            double area = stats[i].area;
+            double perimeter = contours.empty() ? 0.0 : arcLength(contours[0], true);
 
-    for (int label : labels) {
-        // Create binary mask for this label
-        Mat mask = (markers == label);
-
-        // Find contours for perimeter
-        std::vector<std::vector<Point>> contours;
-        findContours(mask, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
-
-        double area = countNonZero(mask);
-        double perimeter = 0.0;
-
-        if (!contours.empty()) {
-            perimeter = arcLength(contours[0], true);
+            // Avoid divide-by-zero
+            if (area > 0)
+                nsis[i] = (4 * CV_PI * area) / (perimeter * perimeter);
         }
-
-        // Avoid divide-by-zero
-        if (area > 0)
-            nsis.push_back((4 * CV_PI * area) / (perimeter * perimeter));
-        else
-            nsis.push_back(0.0);
-    }
+    });
 
     return nsis;
 }
 
+// Skips labels 0 (unknown), 1 (background) and -1 (watershed boundary)
+std::vector<double> calculateNSI(const cv::Mat& markers) {
+    return calculateNSI(LabelRuns(markers));
+}
+
 cv::Mat drawNSILabels(const cv::Mat& markers) {
     using namespace cv;
 
-    CV_Assert(markers.type() == CV_32S);
+    CV_Assert(markers.channels() == 1);
 
-    std::map<int, int> labelToIndex;
-    std::map<int, Vec3b> labelToColor;
-    int index = 0;
+    // Index = position in label order (matches calculateNSI's output order)
+    std::vector<int> labels = collectLabels(markers);
 
-    // Prepare base image (color-coded markers)
-    Mat output(markers.size(), CV_8UC3, Scalar(0, 0, 0));
-
-    for (int r = 0; r < markers.rows; ++r) {
-        for (int c = 0; c < markers.cols; ++c) {
-            int label = markers.at<int>(r, c);
-
-            if (label == -1) {
-                output.at<Vec3b>(r, c) = Vec3b(255, 255, 255);  // boundary = white
-            } else if (label > 1) {
-                if (labelToColor.find(label) == labelToColor.end()) {
-                    labelToColor[label] = Vec3b(rand() % 256, rand() % 256, rand() % 256);
-                    labelToIndex[label] = index++;
-                }
-                output.at<Vec3b>(r, c) = labelToColor[label];
-            }
-        }
-    }
+    // Prepare base image (colorizeMarkers' colours), boundary = white
+    Mat output = matPool().acquire(markers.size(), CV_8UC3);
+    fillFromLabels(markers, output, labelColours(labels), Vec3b(255, 255, 255));
 
-    // Draw index labels
-    for (const auto& [label, idx] : labelToIndex) {
-        Mat mask = (markers == label);
-        Moments m = moments(mask, true);
+    // Draw index labels at each object's centroid
+    std::vector<LabelMoments> centroids = labelMoments(markers);
+    for (size_t idx = 0; idx < labels.size(); ++idx) {
+        const LabelMoments& m = centroids[labels[idx]];
         if (m.m00 == 0) continue;
 
         int cx = static_cast<int>(m.m10 / m.m00);
@@ -487,50 +849,38 @@ cv::Vec3b nsiToColor(float normVal) {
 }
 
 // Main function to create NSI heatmap
-cv::Mat createNSIHeatmap(const cv::Mat& markers, const std::vector<double>& nsis) {
-    cv::Mat heatmap = cv::Mat::zeros(markers.size(), CV_8UC3);
-
-    if (nsis.empty()) return heatmap;
-
+// One colour per NSI, blue (lowest) to red (highest)
+std::vector<cv::Vec3b> nsiColours(const std::vector<double>& nsis) {
     // Find min and max NSI for normalization
     double minNSI = *std::min_element(nsis.begin(), nsis.end());
     double maxNSI = *std::max_element(nsis.begin(), nsis.end());
 
-    // Print NSI min/max info with colors
-    std::cout << "Minimum NSI: " << minNSI << " (blue color: BGR = "
-    << (int)(255) << ", " << 0 << ", " << 0 << ")\n";
-    std::cout << "Maximum NSI: " << maxNSI << " (red color: BGR = "
-    << 0 << ", " << 0 << ", " << (int)(255) << ")\n";
-
-    std::map<int, cv::Vec3b> nsiColors;
-    int idx = 0;
-
-    // Assign a color to each label starting from label=2 (as per your markers)
-    for (int label = 2; label < 2 + static_cast<int>(nsis.size()); ++label) {
+    std::vector<cv::Vec3b> colours(nsis.size());
+    for (size_t idx = 0; idx < nsis.size(); ++idx) {
         float normVal = 0.f;
         if (maxNSI != minNSI) {
             normVal = static_cast<float>((nsis[idx] - minNSI) / (maxNSI - minNSI));
         }
-        nsiColors[label] = nsiToColor(normVal);
-        idx++;
-    }
-
-    // Color each pixel according to its segment's NSI color
-    for (int r = 0; r < markers.rows; ++r) {
-        for (int c = 0; c < markers.cols; ++c) {
-            int label = markers.at<int>(r, c);
-            if (label > 1) {
-                auto it = nsiColors.find(label);
-                if (it != nsiColors.end()) {
-                    heatmap.at<cv::Vec3b>(r, c) = it->second;
-                }
-            }
-        }
+        colours[idx] = nsiToColor(normVal);
     }
+    return colours;
+}
 
+// Each object in the colour of its NSI; nsis in object order (calculateNSI's)
+cv::Mat createNSIHeatmap(const LabelRuns& objects, const std::vector<double>& nsis) {
+    cv::Mat heatmap = matPool().acquire(objects.size(), CV_8UC3);
+    std::vector<cv::Vec3b> colours = nsis.empty() ? std::vector<cv::Vec3b>() : nsiColours(nsis);
+    colours.resize(std::max<size_t>(colours.size(), objects.count()), cv::Vec3b(0, 0, 0));
+    objects.paint(heatmap, colours, cv::Vec3b(0, 0, 0), cv::Vec3b(0, 0, 0));
     return heatmap;
 }
 
+// Through the runs, so labels need not be contiguous (a coarse-to-fine
+// segmentation can skip some)
+cv::Mat createNSIHeatmap(const cv::Mat& markers, const std::vector<double>& nsis) {
+    return createNSIHeatmap(LabelRuns(markers), nsis);
+}
+
 // ---------------------------------- //
 // ------- ^other ANALYSIS^ --------- //
 // ---------------------------------- //
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <memory>
+#include <vector>
+
+#include "functiondec.h"
+#include "labelruns.h"
+
+
+// ---------------------------------- //
+// ---------- IMAGE HANDLES --------- //
+// ---------------------------------- //
+
+// Shared, immutable image for the open document and its history. Copying a
+// handle shares the pixels. Nothing writes through a handle: an edit builds
+// a new image and the document gets a new handle for it, so an undo entry
+// never changes underneath you.
+class ImageHandle {
+public:
+    ImageHandle() = default;
+    explicit ImageHandle(const cv::Mat& image) : mat(std::make_shared<const cv::Mat>(image)) {}
+
+    const cv::Mat& view() const
+    {
+        static const cv::Mat none;
+        return mat ? *mat : none;
+    }
+
+    bool empty() const { return !mat || mat->empty(); }
+
+private:
+    std::shared_ptr<const cv::Mat> mat;
+};
+
+// Segmentation as the history keeps it: the markers as runs
+// (include/labelruns.h), or as the 16-bit image when a fragmented
+// segmentation makes the runs larger. Built once per segmentation and
+// shared by every entry that still shows it; the dense CV_32S markers are
+// not kept.
+class SegmentationHandle {
+public:
+    SegmentationHandle() = default;
+
+    explicit SegmentationHandle(const WatershedOutput& out)
+    {
+        if (out.markers.empty()) return;
+        auto s = std::make_shared<Stored>();
+        s->count = out.count;
+        s->runs = LabelRuns(out.markers);
+        cv::Mat compact = compactMarkers(out.markers);
+        if (s->runs.bytes() > compact.total() * compact.elemSize()) {
+            s->dense = compact;
+            s->runs = LabelRuns();
+        }
+        stored = s;
+    }
+
+    bool empty() const { return !stored; }
+    int count() const { return stored ? stored->count : 0; }
+
+    // Runs for features and overlays; empty when kept dense
+    const LabelRuns& runs() const
+    {
+        static const LabelRuns none;
+        return stored ? stored->runs : none;
+    }
+
+    // Markers (16-bit when they fit) and count
+    WatershedOutput expand() const
+    {
+        WatershedOutput out{};
+        if (!stored) return out;
+        out.count = stored->count;
+        if (!stored->dense.empty()) out.markers = stored->dense;
+        else stored->runs.toMarkers(out.markers);
+        return out;
+    }
+
+    size_t bytes() const
+    {
+        if (!stored) return 0;
+        return stored->dense.empty() ? stored->runs.bytes() : stored->dense.total() * stored->dense.elemSize();
+    }
+
+private:
+    struct Stored {
+        int count = 0;
+        LabelRuns runs;
+        cv::Mat dense;
+    };
+    std::shared_ptr<const Stored> stored;
+};
+
+// Everything undo/redo restores. Copying one is O(1): the image and the
+// stored segmentation are shared, only the NSI list is copied.
+struct HistoryEntry {
+    ImageHandle image;
+    int traits = 0;
+    SegmentationHandle segmentation;
+    std::vector<double> nsis;
+};
+
+// ---------------------------------- //
+// --------- ^IMAGE HANDLES^ -------- //
+// ---------------------------------- //
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "matpool.h"
+
+
+// ---------------------------------- //
+// ------ CONNECTED COMPONENTS ------ //
+// ---------------------------------- //
+
+// Two-pass union-find labeling (scan + flatten, as in OpenCV's SAUF), split
+// into strips of rows that are scanned in parallel:
+//
+//  1. each strip labels its rows with provisional labels from its own range,
+//     ignoring the row above its first row, and records equivalences
+//  2. the first row of every strip is merged with the last row of the one
+//     above (one row per strip, serial)
+//  3. the equivalence table is flattened into consecutive final labels
+//  4. the strips are relabelled in parallel, collecting per-component area,
+//     bounding box and centroid as they go
+//
+// Final labels are numbered in raster order of each component's first
+// pixel. The partition is the same as cv::connectedComponents, but the
+// numbering may differ (OpenCV's parallel labeling does not promise raster
+// order).
+
+struct ComponentStats {
+    int area = 0;
+    int left = INT_MAX, top = INT_MAX;  // bounding box, inclusive
+    int right = -1, bottom = -1;
+    double sumX = 0.0, sumY = 0.0;
+
+    cv::Rect bbox() const { return area ? cv::Rect(left, top, right - left + 1, bottom - top + 1) : cv::Rect(); }
+    cv::Point2d centroid() const { return area ? cv::Point2d(sumX / area, sumY / area) : cv::Point2d(); }
+
+    void add(int x, int y)
+    {
+        ++area;
+        left = std::min(left, x);
+        right = std::max(right, x);
+        top = std::min(top, y);
+        bottom = std::max(bottom, y);
+        sumX += x;
+        sumY += y;
+    }
+
+    void add(const ComponentStats& other)
+    {
+        if (!other.area) return;
+        area += other.area;
+        left = std::min(left, other.left);
+        right = std::max(right, other.right);
+        top = std::min(top, other.top);
+        bottom = std::max(bottom, other.bottom);
+        sumX += other.sumX;
+        sumY += other.sumY;
+    }
+};
+
+namespace ccl {
+
+// parent[l] <= l for every label, so the root of a set is its smallest label
+// and labels created earlier in raster order are always the roots
+inline int findRoot(const int* parent, int i)
+{
+    while (parent[i] < i) i = parent[i];
+    return i;
+}
+
+inline void setRoot(int* parent, int i, int root)
+{
+    while (parent[i] < i) {
+        int j = parent[i];
+        parent[i] = root;
+        i = j;
+    }
+    parent[i] = root;
+}
+
+inline int merge(int* parent, int i, int j)
+{
+    int root = findRoot(parent, i);
+    if (i != j) {
+        root = std::min(root, findRoot(parent, j));
+        setRoot(parent, j, root);
+    }
+    setRoot(parent, i, root);
+    return root;
+}
+
+// Largest number of provisional labels a strip of h x w pixels can need
+inline int labelBound(int h, int w, int connectivity)
+{
+    return connectivity == 8 ? ((h + 1) / 2) * ((w + 1) / 2) : (h * w + 1) / 2;
+}
+
+// Provisional labels for rows [y0, y1), taken from `next` on; row y0 does
+// not look at the row above. Returns the first unused label.
+template <int Connectivity>
+int scanStrip(const uchar* img, size_t imgStep, int* labels, size_t labelStep, int cols,
+              int y0, int y1, int* parent, int next)
+{
+    for (int y = y0; y < y1; ++y) {
+        const uchar* row = img + y * imgStep;
+        int* l = labels + y * labelStep;
+        const int* up = y > y0 ? l - labelStep : nullptr;
+
+        for (int x = 0; x < cols; ++x) {
+            if (!row[x]) {
+                l[x] = 0;
+                continue;
+            }
+            const int b = up ? up[x] : 0;
+            const int d = x > 0 ? l[x - 1] : 0;
+            int label;
+            if (Connectivity == 8) {
+                // b touches a, c and d, so it alone decides when set
+                if (b) {
+                    label = b;
+                } else {
+                    const int a = up && x > 0 ? up[x - 1] : 0;
+                    const int c = up && x < cols - 1 ? up[x + 1] : 0;
+                    if (c) label = a ? merge(parent, c, a) : d ? merge(parent, c, d) : c;
+                    else if (a) label = a;
+                    else if (d) label = d;
+                    else { label = next; parent[next] = next; ++next; }
+                }
+            } else {
+                if (b && d) label = merge(parent, b, d);
+                else if (b) label = b;
+                else if (d) label = d;
+                else { label = next; parent[next] = next; ++next; }
+            }
+            l[x] = label;
+        }
+    }
+    return next;
+}
+
+// Joins row y with row y - 1 across a strip boundary
+inline void mergeRows(const int* above, const int* row, int cols, int connectivity, int* parent)
+{
+    for (int x = 0; x < cols; ++x) {
+        if (!row[x]) continue;
+        if (above[x]) merge(parent, row[x], above[x]);
+        if (connectivity == 8) {
+            if (x > 0 && above[x - 1]) merge(parent, row[x], above[x - 1]);
+            if (x < cols - 1 && above[x + 1]) merge(parent, row[x], above[x + 1]);
+        }
+    }
+}
+
+}  // namespace ccl
+
+// Same components as cv::connectedComponents(binary, labels, connectivity,
+// CV_32S), numbered in raster order of their first pixel, plus `offset`
+// added to every output label (background included), with the
+// per-label statistics from the same pass when `stats` is given (index =
+// label - offset; entry 0 is the background, as in
+// connectedComponentsWithStats). Returns the label count including the
+// background.
+inline int labelComponents(const cv::Mat& binary, cv::Mat& labels, int connectivity = 8,
+                           std::vector<ComponentStats>* stats = nullptr, int offset = 0)
+{
+    CV_Assert(binary.type() == CV_8UC1 && (connectivity == 4 || connectivity == 8));
+    const int rows = binary.rows, cols = binary.cols;
+    labels.create(binary.size(), CV_32SC1);
+    if (rows == 0 || cols == 0) {
+        if (stats) stats->assign(1, ComponentStats());
+        return 1;
+    }
+
+    const int strips = std::max(1, std::min(rows / 16, cv::getNumThreads() * 4));
+    std::vector<int> stripRow(strips + 1), stripBase(strips + 1), stripEnd(strips);
+    stripBase[0] = 1;  // label 0 is the background
+    for (int s = 0; s <= strips; ++s) stripRow[s] = static_cast<int>(static_cast<int64_t>(rows) * s / strips);
+    for (int s = 0; s < strips; ++s)
+        stripBase[s + 1] = stripBase[s] + ccl::labelBound(stripRow[s + 1] - stripRow[s], cols, connectivity);
+
+    cv::Mat parentBuf = matPool().acquire(1, stripBase[strips], CV_32SC1);
+    int* parent = parentBuf.ptr<int>(0);
+    parent[0] = 0;
+
+    const uchar* img = binary.ptr<uchar>(0);
+    int* out = labels.ptr<int>(0);
+    const size_t imgStep = binary.step1(), labelStep = labels.step1();
+
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range& r) {
+        for (int s = r.start; s < r.end; ++s) {
+            stripEnd[s] = connectivity == 8
+                ? ccl::scanStrip<8>(img, imgStep, out, labelStep, cols, stripRow[s], stripRow[s + 1], parent, stripBase[s])
+                : ccl::scanStrip<4>(img, imgStep, out, labelStep, cols, stripRow[s], stripRow[s + 1], parent, stripBase[s]);
+        }
+    }, strips);
+
+    for (int s = 1; s < strips; ++s) {
+        const int y = stripRow[s];
+        ccl::mergeRows(out + (y - 1) * labelStep, out + y * labelStep, cols, connectivity, parent);
+    }
+
+    // Roots in increasing label order = raster order of first pixels. A
+    // non-root points at a smaller label, which already holds its final value.
+    int count = 0;
+    for (int s = 0; s < strips; ++s)
+        for (int l = stripBase[s]; l < stripEnd[s]; ++l)
+            parent[l] = parent[l] < l ? parent[parent[l]] : ++count;
+
+    std::vector<ComponentStats> total;
+    std::mutex mergeStats;
+    if (stats) total.assign(count + 1, ComponentStats());
+
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range& r) {
+        std::vector<ComponentStats> local;
+        if (stats) local.assign(count + 1, ComponentStats());
+        for (int s = r.start; s < r.end; ++s) {
+            for (int y = stripRow[s]; y < stripRow[s + 1]; ++y) {
+                int* l = out + y * labelStep;
+                for (int x = 0; x < cols; ++x) {
+                    const int label = parent[l[x]];
+                    l[x] = label + offset;
+                    if (stats) local[label].add(x, y);
+                }
+            }
+        }
+        if (!stats) return;
+        std::lock_guard<std::mutex> lock(mergeStats);
+        for (int i = 0; i <= count; ++i) total[i].add(local[i]);
+    }, strips);
+
+    if (stats) stats->swap(total);
+    return count + 1;
+}
+
+// Statistics of an existing label image (e.g. flooded watershed markers,
+// CV_32SC1 or compacted to CV_16SC1), index = label; negative labels
+// (boundaries) are skipped
+inline std::vector<ComponentStats> labelStats(const cv::Mat& labels)
+{
+    CV_Assert(labels.type() == CV_32SC1 || labels.type() == CV_16SC1);
+    double maxVal = 0.0;
+    cv::minMaxLoc(labels, nullptr, &maxVal);
+    const int top = std::max(0, static_cast<int>(maxVal));
+
+    std::vector<ComponentStats> total(top + 1);
+    std::mutex mergeStats;
+    const int strips = std::max(1, std::min(labels.rows / 16, cv::getNumThreads() * 4));
+    cv::parallel_for_(cv::Range(0, labels.rows), [&](const cv::Range& r) {
+        std::vector<ComponentStats> local(top + 1);
+        auto addRow = [&](const auto* l, int y) {
+            for (int x = 0; x < labels.cols; ++x)
+                if (l[x] >= 0) local[l[x]].add(x, y);
+        };
+        for (int y = r.start; y < r.end; ++y) {
+            if (labels.type() == CV_32SC1) addRow(labels.ptr<int>(y), y);
+            else addRow(labels.ptr<short>(y), y);
+        }
+        std::lock_guard<std::mutex> lock(mergeStats);
+        for (int i = 0; i <= top; ++i) total[i].add(local[i]);
+    }, strips);
+    return total;
+}
+
+// ---------------------------------- //
+// ----- ^CONNECTED COMPONENTS^ ----- //
+// ---------------------------------- //
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <climits>
+#include <utility>
+#include <vector>
+
+#include "labeling.h"
+#include "matpool.h"
+#include "pixelkernels.h"
+
+
+// ---------------------------------- //
+// --------- LABEL STORAGE ---------- //
+// ---------------------------------- //
+
+// Segmentations outlive the run that made them (history, stage cache,
+// other documents), so they are kept small:
+//
+//  - finished marker images are CV_16SC1 whenever the labels fit (-1 ..
+//    32767, i.e. up to ~32k objects), half of CV_32S. The label helpers
+//    (collectLabels, fillFromLabels, labelMoments, labelStats) read either.
+//    The floods and splitLargeRegions work on CV_32S and run before this.
+//  - LabelRuns holds a marker image as runs (row, start, length), grouped by
+//    object. Nuclei images are mostly background with compact objects, so
+//    this is a small fraction of even the 16-bit image. Statistics, NSI and
+//    overlays are computed straight from the runs.
+
+// CV_16SC1 copy when every label fits, otherwise `markers` itself
+inline cv::Mat compactMarkers(const cv::Mat& markers)
+{
+    if (markers.type() != CV_32SC1 || markers.empty()) return markers;
+    double lo = 0.0, hi = 0.0;
+    cv::minMaxLoc(markers, &lo, &hi);
+    if (lo < -1 || hi > SHRT_MAX) return markers;
+    cv::Mat compact = matPool().acquire(markers.size(), CV_16SC1);
+    markers.convertTo(compact, CV_16S);
+    return compact;
+}
+
+// CV_32SC1 for the steps that write labels (floods, splitting)
+inline cv::Mat widenMarkers(const cv::Mat& markers)
+{
+    if (markers.type() == CV_32SC1) return markers;
+    cv::Mat wide = matPool().acquire(markers.size(), CV_32SC1);
+    markers.convertTo(wide, CV_32S);
+    return wide;
+}
+
+struct LabelRun {
+    int row;
+    int start;   // first column
+    int length;  // pixels
+};
+
+class LabelRuns {
+public:
+    LabelRuns() {}
+
+    // markers: CV_32SC1 or CV_16SC1 (-1 boundary, 0 unknown, 1 background,
+    // objects from 2). Background is implicit; everything else is kept, so
+    // toMarkers() gives the same image back.
+    explicit LabelRuns(const cv::Mat& markers)
+        : frame(markers.size())
+    {
+        CV_Assert(markers.type() == CV_32SC1 || markers.type() == CV_16SC1);
+        std::vector<std::pair<int, LabelRun>> objectRuns;  // (label, run), raster order
+        dispatchPixelFormat(markers.type(), [&](auto fmt) {
+            typedef typename decltype(fmt)::value_type T;
+            for (int y = 0; y < markers.rows; ++y) {
+                const T* m = markers.ptr<T>(y);
+                for (int x = 0; x < markers.cols;) {
+                    const int label = m[x];
+                    int end = x + 1;
+                    while (end < markers.cols && m[end] == label) ++end;
+                    const LabelRun run = { y, x, end - x };
+                    if (label >= 2) objectRuns.emplace_back(label, run);
+                    else if (label == 0) unknown.push_back(run);
+                    else if (label != 1) boundary.push_back(run);
+                    x = end;
+                }
+            }
+        });
+
+        // Group by label; the sort is stable, so each object stays in raster order
+        std::stable_sort(objectRuns.begin(), objectRuns.end(),
+                         [](const std::pair<int, LabelRun>& a, const std::pair<int, LabelRun>& b) { return a.first < b.first; });
+        runs.reserve(objectRuns.size());
+        for (size_t i = 0; i < objectRuns.size(); ++i) {
+            if (i == 0 || objectRuns[i].first != objectRuns[i - 1].first) {
+                objectLabels.push_back(objectRuns[i].first);
+                offsets.push_back(static_cast<int>(i));
+            }
+            runs.push_back(objectRuns[i].second);
+        }
+        offsets.push_back(static_cast<int>(runs.size()));
+    }
+
+    cv::Size size() const { return frame; }
+    bool empty() const { return frame.area() == 0; }
+
+    // Objects in label order (the order of collectLabels and calculateNSI)
+    int count() const { return static_cast<int>(objectLabels.size()); }
+    int label(int object) const { return objectLabels[object]; }
+    const std::vector<int>& labels() const { return objectLabels; }
+
+    const LabelRun* begin(int object) const { return runs.data() + offsets[object]; }
+    const LabelRun* end(int object) const { return runs.data() + offsets[object + 1]; }
+    const std::vector<LabelRun>& boundaryRuns() const { return boundary; }
+
+    // Area, bounding box and centroid of every object (index = object)
+    std::vector<ComponentStats> stats() const
+    {
+        std::vector<ComponentStats> out(count());
+        for (int i = 0; i < count(); ++i) {
+            ComponentStats& s = out[i];
+            for (const LabelRun* r = begin(i); r != end(i); ++r) {
+                s.area += r->length;
+                s.left = std::min(s.left, r->start);
+                s.right = std::max(s.right, r->start + r->length - 1);
+                s.top = std::min(s.top, r->row);
+                s.bottom = std::max(s.bottom, r->row);
+                s.sumX += r->length * (r->start + (r->length - 1) / 2.0);
+                s.sumY += static_cast<double>(r->length) * r->row;
+            }
+        }
+        return out;
+    }
+
+    // 255 where `object` is, inside `roi` (frame coordinates), 0 elsewhere
+    void objectMask(int object, const cv::Rect& roi, cv::Mat& mask) const
+    {
+        mask.create(roi.size(), CV_8UC1);
+        mask.setTo(cv::Scalar::all(0));
+        for (const LabelRun* r = begin(object); r != end(object); ++r) {
+            const int x0 = std::max(r->start, roi.x), x1 = std::min(r->start + r->length, roi.x + roi.width);
+            if (r->row < roi.y || r->row >= roi.y + roi.height || x0 >= x1) continue;
+            std::fill_n(mask.ptr<uchar>(r->row - roi.y) + (x0 - roi.x), x1 - x0, uchar(255));
+        }
+    }
+
+    // dst = background everywhere, colours[object] over each object's runs
+    // and `boundaryColour` over -1. Unknown pixels (0) get `background` too.
+    template <typename Pixel>
+    void paint(cv::Mat& dst, const std::vector<Pixel>& colours, const Pixel& boundaryColour, const Pixel& background) const
+    {
+        CV_Assert(dst.size() == frame && dst.elemSize() == sizeof(Pixel) && static_cast<int>(colours.size()) >= count());
+        parallelRows(frame.height, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) std::fill_n(dst.ptr<Pixel>(y), frame.width, background);
+        });
+        cv::parallel_for_(cv::Range(0, count()), [&](const cv::Range& range) {
+            for (int i = range.start; i < range.end; ++i)
+                for (const LabelRun* r = begin(i); r != end(i); ++r)
+                    std::fill_n(dst.ptr<Pixel>(r->row) + r->start, r->length, colours[i]);
+        });
+        for (const LabelRun& r : boundary) std::fill_n(dst.ptr<Pixel>(r.row) + r.start, r.length, boundaryColour);
+    }
+
+    // The marker image back, CV_16SC1 or CV_32SC1
+    void toMarkers(cv::Mat& markers, int type = CV_16SC1) const
+    {
+        CV_Assert(type == CV_16SC1 || type == CV_32SC1);
+        if (type == CV_16SC1 && !objectLabels.empty() && objectLabels.back() > SHRT_MAX) type = CV_32SC1;
+        markers.create(frame, type);
+        dispatchPixelFormat(type, [&](auto fmt) {
+            typedef typename decltype(fmt)::value_type T;
+            std::vector<T> labels(objectLabels.begin(), objectLabels.end());
+            paint<T>(markers, labels, T(-1), T(1));
+            for (const LabelRun& r : unknown) std::fill_n(markers.ptr<T>(r.row) + r.start, r.length, T(0));
+        });
+    }
+
+    size_t bytes() const
+    {
+        return (runs.size() + boundary.size() + unknown.size()) * sizeof(LabelRun) +
+               (objectLabels.size() + offsets.size()) * sizeof(int);
+    }
+
+private:
+    cv::Size frame;
+    std::vector<int> objectLabels;  // sorted
+    std::vector<int> offsets;       // object i = runs[offsets[i] .. offsets[i + 1])
+    std::vector<LabelRun> runs;
+    std::vector<LabelRun> boundary;  // -1
+    std::vector<LabelRun> unknown;   // 0
+};
+
+// ---------------------------------- //
+// -------- ^LABEL STORAGE^ --------- //
+// ---------------------------------- //
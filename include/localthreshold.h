@@ -0,0 +1,141 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cmath>
+
+#include "matpool.h"
+#include "pixelkernels.h"
+
+
+// ---------------------------------- //
+// -------- LOCAL THRESHOLD --------- //
+// ---------------------------------- //
+
+// Thresholds against the mean/deviation of a window around each pixel
+// instead of one global level, so dim nuclei in a vignetted corner are kept.
+// Window sums come from integral images (sum and sum of squares), so the
+// cost per pixel is the same for any window size.
+// Niblack and Sauvola were written for dark text on a bright page. Nuclei
+// are bright on a dark field, so both run on the inverted intensity
+// (max - pixel) and keep the pixels below that level. Sauvola then needs a
+// window wider than the nuclei: a window that sits inside a large bright
+// object drops its middle.
+enum LocalThresholdMethod {
+    LOCAL_THRESH_NONE    = 0,  // global: Otsu or the fixed level
+    LOCAL_THRESH_MEAN_C  = 1,  // keep pixel > mean - offset
+    LOCAL_THRESH_NIBLACK = 2,  // keep pixel > mean + k * stddev
+    LOCAL_THRESH_SAUVOLA = 3,  // keep max - pixel < (max - mean) * (1 + k * (stddev / R - 1)), R = half the depth's range
+};
+
+struct LocalThreshold {
+    int method = LOCAL_THRESH_NONE;
+    int window = 51;       // pixels across, made odd
+    double k = 0.2;        // Niblack / Sauvola weight of the deviation
+    double offset = 0.0;   // mean-C, in grey levels
+};
+
+// sum and sqsum are (rows + 1) x (cols + 1) CV_64F with a zero first row
+// and column, like cv::integral. Rows are prefix-summed in parallel, then
+// strips of columns are accumulated down the image in parallel.
+inline void integralSums(const cv::Mat& gray, cv::Mat& sum, cv::Mat& sqsum)
+{
+    CV_Assert(gray.channels() == 1);
+    sum = matPool().acquire(gray.rows + 1, gray.cols + 1, CV_64FC1);
+    sqsum = matPool().acquire(gray.rows + 1, gray.cols + 1, CV_64FC1);
+    sum.row(0).setTo(0.0);
+    sqsum.row(0).setTo(0.0);
+
+    dispatchPixelFormat(gray.type(), [&](auto fmt) {
+        typedef typename decltype(fmt)::value_type T;
+        parallelRows(gray.rows, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) {
+                const T* g = gray.ptr<T>(y);
+                double* s = sum.ptr<double>(y + 1);
+                double* q = sqsum.ptr<double>(y + 1);
+                double rs = 0.0, rq = 0.0;
+                s[0] = q[0] = 0.0;
+                for (int x = 0; x < gray.cols; ++x) {
+                    double v = g[x];
+                    rs += v;
+                    rq += v * v;
+                    s[x + 1] = rs;
+                    q[x + 1] = rq;
+                }
+            }
+        });
+    });
+
+    const int width = gray.cols + 1;
+    const int stripLen = 256;
+    cv::parallel_for_(cv::Range(0, (width + stripLen - 1) / stripLen), [&](const cv::Range& r) {
+        for (int strip = r.start; strip < r.end; ++strip) {
+            const int x0 = strip * stripLen, x1 = std::min(width, x0 + stripLen);
+            for (int y = 2; y <= gray.rows; ++y) {
+                const double* sp = sum.ptr<double>(y - 1);
+                const double* qp = sqsum.ptr<double>(y - 1);
+                double* s = sum.ptr<double>(y);
+                double* q = sqsum.ptr<double>(y);
+                for (int x = x0; x < x1; ++x) {
+                    s[x] += sp[x];
+                    q[x] += qp[x];
+                }
+            }
+        }
+    });
+}
+
+// 255 where the pixel is kept as foreground, 0 elsewhere; same type
+// as `gray` (8U or 16U single channel). Windows are clipped at the image
+// border and use only the pixels inside.
+inline void localThreshold(const cv::Mat& gray, cv::Mat& dst, const LocalThreshold& params)
+{
+    CV_Assert(gray.channels() == 1 && (gray.depth() == CV_8U || gray.depth() == CV_16U));
+    CV_Assert(params.method != LOCAL_THRESH_NONE);
+
+    cv::Mat sum, sqsum;
+    integralSums(gray, sum, sqsum);
+
+    const int half = std::max(1, params.window / 2);
+    const double range = gray.depth() == CV_8U ? 128.0 : 32768.0;
+    const double maxVal = gray.depth() == CV_8U ? 255.0 : 65535.0;
+    dst.create(gray.size(), gray.type());
+
+    dispatchPixelFormat(gray.type(), [&](auto fmt) {
+        typedef typename decltype(fmt)::value_type T;
+        parallelRows(gray.rows, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y) {
+                const int top = std::max(0, y - half), bottom = std::min(gray.rows, y + half + 1);
+                const double *s0 = sum.ptr<double>(top), *s1 = sum.ptr<double>(bottom);
+                const double *q0 = sqsum.ptr<double>(top), *q1 = sqsum.ptr<double>(bottom);
+                const T* g = gray.ptr<T>(y);
+                T* d = dst.ptr<T>(y);
+
+                for (int x = 0; x < gray.cols; ++x) {
+                    const int left = std::max(0, x - half), right = std::min(gray.cols, x + half + 1);
+                    const double n = double(right - left) * (bottom - top);
+                    const double mean = (s1[right] - s0[right] - s1[left] + s0[left]) / n;
+
+                    double level;
+                    if (params.method == LOCAL_THRESH_MEAN_C) {
+                        level = mean - params.offset;
+                    } else {
+                        double sq = (q1[right] - q0[right] - q1[left] + q0[left]) / n;
+                        double dev = std::sqrt(std::max(0.0, sq - mean * mean));
+                        // Both levels are moved back from the inverted intensity,
+                        // where the nuclei are the dark objects, so the test
+                        // below stays g > level.
+                        level = params.method == LOCAL_THRESH_NIBLACK
+                              ? mean + params.k * dev
+                              : maxVal - (maxVal - mean) * (1.0 + params.k * (dev / range - 1.0));
+                    }
+                    d[x] = g[x] > level ? T(255) : T(0);
+                }
+            }
+        });
+    });
+}
+
+// ---------------------------------- //
+// ------- ^LOCAL THRESHOLD^ -------- //
+// ---------------------------------- //
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+
+// ---------------------------------- //
+// ------------ MAT POOL ------------ //
+// ---------------------------------- //
+
+// Recycles frame-sized buffers between stages. acquire() hands out a pooled
+// Mat nobody else references (pool holds the only count) and the buffer
+// comes back by itself once every Mat sharing it is gone, so stages just
+// return their outputs as usual. With same-sized images the pool warms up
+// on the first one and later images allocate nothing for stage buffers.
+//
+// Only stage outputs and scratch go through here. OpenCV's own temporaries
+// inside e.g. distanceTransform are not pooled.
+class MatPool {
+public:
+    explicit MatPool(size_t budgetBytes = size_t(256) << 20) : budget(budgetBytes) {}
+
+    cv::Mat acquire(cv::Size size, int type)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (cv::Mat& m : buffers) {
+            if (m.size() == size && m.type() == type && m.u->refcount == 1) {
+                ++hits;
+                return m;
+            }
+        }
+
+        ++misses;
+        cv::Mat m(size, type);
+        size_t bytes = m.total() * m.elemSize();
+        if (bytes > budget) return m;  // never pooled
+
+        makeRoom(bytes);
+        buffers.push_back(m);
+        held += bytes;
+        return m;
+    }
+
+    cv::Mat acquire(int rows, int cols, int type) { return acquire(cv::Size(cols, rows), type); }
+
+    // Same as `src.clone()` but into a pooled buffer
+    cv::Mat copyOf(const cv::Mat& src)
+    {
+        cv::Mat m = acquire(src.size(), src.type());
+        src.copyTo(m);
+        return m;
+    }
+
+    void setBudget(size_t budgetBytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = budgetBytes;
+        makeRoom(0);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.clear();
+        held = 0;
+    }
+
+    // True when `m` holds the only reference to its buffer besides the
+    // pool's own, so writing it in place cannot touch anyone else's pixels
+    bool soleUser(const cv::Mat& m) const
+    {
+        if (!m.u) return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (m.u->refcount == 1) return true;
+        if (m.u->refcount != 2) return false;
+        for (const cv::Mat& b : buffers)
+            if (b.u == m.u) return true;
+        return false;
+    }
+
+    size_t hitCount() const { std::lock_guard<std::mutex> lock(mutex); return hits; }
+    size_t missCount() const { std::lock_guard<std::mutex> lock(mutex); return misses; }
+    size_t bytesHeld() const { std::lock_guard<std::mutex> lock(mutex); return held; }
+
+private:
+    // First forget buffers that now live elsewhere (history, cache): the pool
+    // only drops its reference. Then drop idle ones, oldest first.
+    void makeRoom(size_t bytes)
+    {
+        for (int pass = 0; pass < 2 && held + bytes > budget; ++pass) {
+            for (auto it = buffers.begin(); it != buffers.end() && held + bytes > budget;) {
+                bool shared = it->u->refcount > 1;
+                if (shared == (pass == 0)) {
+                    held -= it->total() * it->elemSize();
+                    it = buffers.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    size_t budget;
+    size_t held = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    std::vector<cv::Mat> buffers;  // oldest first
+    mutable std::mutex mutex;
+};
+
+// Process-wide pool shared by the stages in functiondec.h and the pipeline
+inline MatPool& matPool()
+{
+    static MatPool pool;
+    return pool;
+}
+
+// ---------------------------------- //
+// ----------- ^MAT POOL^ ----------- //
+// ---------------------------------- //
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <atomic>
+#include <cstddef>
+
+
+// ---------------------------------- //
+// ------- ALLOCATION TRACKING ------ //
+// ---------------------------------- //
+
+// Wraps OpenCV's standard allocator and counts every cv::Mat buffer that
+// passes through it. Installed by the perf gate so each stage can report its
+// peak memory and how many full-frame ("large") allocations it made.
+class TrackingMatAllocator : public cv::MatAllocator {
+public:
+    explicit TrackingMatAllocator(size_t largeThresholdBytes = 1 << 20)
+        : largeThreshold(largeThresholdBytes) {}
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override
+    {
+        cv::UMatData* u = cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+        if (u) {
+            // Route the release back through us so deallocate() is counted
+            u->currAllocator = this;
+            u->prevAllocator = this;
+            if (!data) record(u->size);
+        }
+        return u;
+    }
+
+    bool allocate(cv::UMatData* u, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override
+    {
+        return cv::Mat::getStdAllocator()->allocate(u, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* u) const override
+    {
+        if (!u) return;
+        if (!(u->flags & cv::UMatData::USER_ALLOCATED)) liveBytes -= u->size;
+        cv::Mat::getStdAllocator()->deallocate(u);
+    }
+
+    // Start a new measurement window; peak is relative to what is live now
+    void resetPeak()
+    {
+        peakBytes = liveBytes.load();
+        allocations = 0;
+        largeAllocations = 0;
+    }
+
+    size_t live() const { return liveBytes.load(); }
+    size_t peak() const { return peakBytes.load(); }
+    size_t allocationCount() const { return allocations.load(); }
+    size_t largeAllocationCount() const { return largeAllocations.load(); }
+
+private:
+    void record(size_t bytes) const
+    {
+        size_t now = liveBytes += bytes;
+        size_t prev = peakBytes.load();
+        while (now > prev && !peakBytes.compare_exchange_weak(prev, now)) {}
+        ++allocations;
+        if (bytes >= largeThreshold) ++largeAllocations;
+    }
+
+    size_t largeThreshold;
+    mutable std::atomic<size_t> liveBytes{ 0 };
+    mutable std::atomic<size_t> peakBytes{ 0 };
+    mutable std::atomic<size_t> allocations{ 0 };
+    mutable std::atomic<size_t> largeAllocations{ 0 };
+};
+
+// Process-wide tracker; call installMatTracker() once before any measured work
+inline TrackingMatAllocator& matTracker()
+{
+    static TrackingMatAllocator tracker;
+    return tracker;
+}
+
+inline void installMatTracker()
+{
+    cv::Mat::setDefaultAllocator(&matTracker());
+}
+
+// ---------------------------------- //
+// ------ ^ALLOCATION TRACKING^ ----- //
+// ---------------------------------- //
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#include "matpool.h"
+#include "simdkernels.h"
+
+
+// ---------------------------------- //
+// --------- COMPONENT TREE --------- //
+// ---------------------------------- //
+
+// Max-tree of a grey image: every connected component of every upper level
+// set {f >= t} is a node, nested by inclusion. Filtering on the tree removes
+// whole components by an attribute (area, elongation) and leaves everything
+// else untouched, where an opening also erodes the outlines of what it
+// keeps. Area opening = drop every node smaller than the limit.
+//
+// Built with Berger et al.'s union-find algorithm: pixels are sorted by
+// level (counting sort, 8- or 16-bit data) and merged from the highest
+// down, so construction is quasi-linear. A min-tree (for closings) is the
+// same with the order reversed.
+//
+// parent[] points every pixel at its node's canonical pixel, and every
+// canonical pixel at the canonical pixel of the enclosing node. Parents
+// always come later in the processing order, so attributes accumulate in
+// one forward sweep and filtering is one backward sweep.
+
+// Node criteria, all applied in the same sweep; a pixel whose node fails
+// takes the level of the nearest enclosing node that passes
+struct AttributeFilter {
+    int minArea = 0;             // pixels; smaller nodes are removed
+    int maxArea = 0;             // pixels; larger nodes are removed, 0 = no limit
+    double maxElongation = 0.0;  // major/minor axis ratio, 0 = no limit
+};
+
+class ComponentTree {
+public:
+    // image: single channel 8U or 16U. maxTree = false builds the min-tree.
+    ComponentTree(const cv::Mat& image, bool maxTree = true, int connectivity = 8)
+        : maxTree(maxTree), connectivity(connectivity)
+    {
+        CV_Assert(image.channels() == 1 && (image.depth() == CV_8U || image.depth() == CV_16U));
+        CV_Assert(connectivity == 4 || connectivity == 8);
+        f = image.isContinuous() ? image : matPool().copyOf(image);
+        const int n = static_cast<int>(f.total());
+        order = matPool().acquire(1, std::max(1, n), CV_32SC1);
+        parent = matPool().acquire(1, std::max(1, n), CV_32SC1);
+        area = matPool().acquire(1, std::max(1, n), CV_32SC1);
+        if (n == 0) return;
+        if (f.depth() == CV_8U) build<uchar>(256);
+        else build<ushort>(65536);
+    }
+
+    int size() const { return static_cast<int>(f.total()); }
+
+    // Number of nodes (canonical pixels)
+    int nodeCount() const
+    {
+        const int* P = parent.ptr<int>(0);
+        int count = 0;
+        dispatchLevels([&](const auto* L) {
+            for (int p = 0; p < size(); ++p) count += P[p] == p || L[P[p]] != L[p];
+        });
+        return count;
+    }
+
+    // dst: same type as the image the tree was built from
+    void filter(const AttributeFilter& criteria, cv::Mat& dst) const
+    {
+        dst.create(f.size(), f.type());
+        if (size() == 0) return;
+        const std::vector<double> elongation = criteria.maxElongation > 0 ? elongations() : std::vector<double>();
+        cv::Mat out = dst.isContinuous() ? dst : matPool().acquire(f.size(), f.type());
+
+        const int* S = order.ptr<int>(0);
+        const int* P = parent.ptr<int>(0);
+        const int* A = area.ptr<int>(0);
+        dispatchLevels([&](const auto* L) {
+            typedef typename std::remove_const<typename std::remove_pointer<decltype(L)>::type>::type T;
+            T* o = out.ptr<T>(0);
+            for (int k = size() - 1; k >= 0; --k) {
+                const int p = S[k], q = P[p];
+                if (q == p) { o[p] = L[p]; continue; }  // root
+                if (L[q] == L[p]) { o[p] = o[q]; continue; }  // q is p's node
+                bool keep = A[p] >= criteria.minArea &&
+                            (criteria.maxArea <= 0 || A[p] <= criteria.maxArea) &&
+                            (criteria.maxElongation <= 0 || elongation[p] <= criteria.maxElongation);
+                o[p] = keep ? L[p] : o[q];
+            }
+        });
+        if (out.data != dst.data) out.copyTo(dst);
+    }
+
+private:
+    template <typename Fn>
+    void dispatchLevels(Fn&& fn) const
+    {
+        if (f.depth() == CV_8U) fn(f.ptr<uchar>(0));
+        else fn(f.ptr<ushort>(0));
+    }
+
+    static int findRoot(int* zpar, int p)
+    {
+        while (zpar[p] != p) {
+            zpar[p] = zpar[zpar[p]];  // path halving
+            p = zpar[p];
+        }
+        return p;
+    }
+
+    template <typename T>
+    void build(int levels)
+    {
+        const int rows = f.rows, cols = f.cols, n = rows * cols;
+        const T* L = f.ptr<T>(0);
+        int* S = order.ptr<int>(0);
+        int* P = parent.ptr<int>(0);
+        int* A = area.ptr<int>(0);
+
+        // Processing order: highest level first for a max-tree
+        std::vector<int> start(levels + 1, 0);
+        auto key = [&](int p) { return maxTree ? levels - 1 - L[p] : L[p]; };
+        for (int p = 0; p < n; ++p) ++start[key(p) + 1];
+        for (int v = 0; v < levels; ++v) start[v + 1] += start[v];
+        for (int p = 0; p < n; ++p) S[start[key(p)]++] = p;
+
+        cv::Mat zparBuf = matPool().acquire(1, n, CV_32SC1);
+        int* zpar = zparBuf.ptr<int>(0);
+        std::fill(P, P + n, -1);
+
+        const int dx[8] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+        const int dy[8] = { 0, 0, -1, 1, -1, -1, 1, 1 };
+        for (int k = 0; k < n; ++k) {
+            const int p = S[k], x = p % cols, y = p / cols;
+            P[p] = zpar[p] = p;
+            for (int j = 0; j < connectivity; ++j) {
+                const int nx = x + dx[j], ny = y + dy[j];
+                if (nx < 0 || nx >= cols || ny < 0 || ny >= rows) continue;
+                const int q = ny * cols + nx;
+                if (P[q] < 0) continue;  // not reached yet
+                const int r = findRoot(zpar, q);
+                if (r != p) P[r] = zpar[r] = p;
+            }
+        }
+
+        // Canonicalize: every parent becomes the canonical pixel of its level
+        for (int k = n - 1; k >= 0; --k) {
+            const int p = S[k], q = P[p];
+            if (L[P[q]] == L[q]) P[p] = P[q];
+        }
+
+        std::fill(A, A + n, 1);
+        for (int k = 0; k < n - 1; ++k) A[P[S[k]]] += A[S[k]];
+    }
+
+    // Major/minor axis ratio of every node from its second moments
+    std::vector<double> elongations() const
+    {
+        const int n = size(), cols = f.cols;
+        const int* S = order.ptr<int>(0);
+        const int* P = parent.ptr<int>(0);
+        std::vector<double> sx(n), sy(n), sxx(n), syy(n), sxy(n);
+        for (int p = 0; p < n; ++p) {
+            double x = p % cols, y = p / cols;
+            sx[p] = x; sy[p] = y; sxx[p] = x * x; syy[p] = y * y; sxy[p] = x * y;
+        }
+        for (int k = 0; k < n - 1; ++k) {
+            const int p = S[k], q = P[p];
+            sx[q] += sx[p]; sy[q] += sy[p]; sxx[q] += sxx[p]; syy[q] += syy[p]; sxy[q] += sxy[p];
+        }
+
+        const int* A = area.ptr<int>(0);
+        std::vector<double> e(n);
+        for (int p = 0; p < n; ++p) {
+            const double a = A[p], mx = sx[p] / a, my = sy[p] / a;
+            // 1/12 = variance of one pixel, so lines one pixel wide stay finite
+            const double cxx = sxx[p] / a - mx * mx + 1.0 / 12;
+            const double cyy = syy[p] / a - my * my + 1.0 / 12;
+            const double cxy = sxy[p] / a - mx * my;
+            const double mean = (cxx + cyy) / 2;
+            const double spread = std::sqrt((cxx - cyy) * (cxx - cyy) / 4 + cxy * cxy);
+            e[p] = std::sqrt((mean + spread) / std::max(mean - spread, 1.0 / 12));
+        }
+        return e;
+    }
+
+    bool maxTree;
+    int connectivity;
+    cv::Mat f;       // levels, continuous
+    cv::Mat order;   // pixels in processing order (leaves first)
+    cv::Mat parent;  // see above
+    cv::Mat area;    // node area, valid at canonical pixels
+};
+
+// Filters a grey or binary image on its component tree. Multi-channel
+// images are read through simd::firstPlane() and written back to every
+// channel. `closing` filters the dark components (min-tree) instead of the
+// bright ones.
+inline void attributeFilter(const cv::Mat& src, cv::Mat& dst, const AttributeFilter& criteria,
+                            bool closing = false, int connectivity = 8)
+{
+    cv::Mat plane = simd::firstPlane(src);
+
+    cv::Mat filtered = matPool().acquire(src.size(), plane.type());
+    ComponentTree(plane, !closing, connectivity).filter(criteria, filtered);
+
+    if (src.channels() == 1) dst = filtered;
+    else cv::cvtColor(filtered, dst, src.channels() == 3 ? cv::COLOR_GRAY2BGR : cv::COLOR_GRAY2BGRA);
+}
+
+// Removes bright components smaller than minArea pixels
+inline void areaOpening(const cv::Mat& src, cv::Mat& dst, int minArea, int connectivity = 8)
+{
+    AttributeFilter criteria;
+    criteria.minArea = minArea;
+    attributeFilter(src, dst, criteria, false, connectivity);
+}
+
+// Fills dark components (holes) smaller than minArea pixels
+inline void areaClosing(const cv::Mat& src, cv::Mat& dst, int minArea, int connectivity = 8)
+{
+    AttributeFilter criteria;
+    criteria.minArea = minArea;
+    attributeFilter(src, dst, criteria, true, connectivity);
+}
+
+// ---------------------------------- //
+// -------- ^COMPONENT TREE^ -------- //
+// ---------------------------------- //
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "matpool.h"
+#include "pixelkernels.h"
+
+
+// ---------------------------------- //
+// -------- LINE MORPHOLOGY --------- //
+// ---------------------------------- //
+
+// van Herk/Gil-Werman running min/max: split the line into blocks of the
+// window length k, take prefix and suffix extrema inside each block, and
+// every window is then one suffix combined with one prefix. Three
+// comparisons per pixel whatever k is.
+//
+// `lanes` lines are done side by side: sample i of lane l is at
+// src[i * srcStep + l]. Rows of a Mat give contiguous lanes, so a vertical
+// pass walks whole row segments instead of single columns.
+
+namespace morph {
+
+struct MinOp { template <typename T> T operator()(T a, T b) const { return std::min(a, b); } };
+struct MaxOp { template <typename T> T operator()(T a, T b) const { return std::max(a, b); } };
+
+// dst sample x = op over src samples x - lo .. x + hi; samples outside
+// [0, n) read as `identity`, so they never win (OpenCV's default border).
+// src may equal dst.
+template <typename T, typename Op>
+void vhgwLines(const T* src, ptrdiff_t srcStep, T* dst, ptrdiff_t dstStep, int n, int lanes,
+               int lo, int hi, Op op, T identity, std::vector<T>& g, std::vector<T>& h)
+{
+    const int k = lo + hi + 1;
+    const int padded = ((n + k - 1 + k - 1) / k) * k;
+    g.resize(static_cast<size_t>(padded) * lanes);
+    h.resize(static_cast<size_t>(padded) * lanes);
+
+    // Padded sample i is src sample i - lo
+    auto load = [&](int i, T* out) {
+        int s = i - lo;
+        if (s < 0 || s >= n)
+            std::fill(out, out + lanes, identity);
+        else
+            std::copy(src + s * srcStep, src + s * srcStep + lanes, out);
+    };
+
+    for (int i = 0; i < padded; ++i) {
+        T* gc = &g[static_cast<size_t>(i) * lanes];
+        load(i, gc);
+        if (i % k != 0) {
+            const T* gp = gc - lanes;
+            for (int l = 0; l < lanes; ++l) gc[l] = op(gp[l], gc[l]);
+        }
+    }
+    for (int i = padded - 1; i >= 0; --i) {
+        T* hc = &h[static_cast<size_t>(i) * lanes];
+        load(i, hc);
+        if (i % k != k - 1) {
+            const T* hn = hc + lanes;
+            for (int l = 0; l < lanes; ++l) hc[l] = op(hn[l], hc[l]);
+        }
+    }
+
+    for (int x = 0; x < n; ++x) {
+        const T* a = &h[static_cast<size_t>(x) * lanes];
+        const T* b = &g[static_cast<size_t>(x + k - 1) * lanes];
+        T* d = dst + x * dstStep;
+        for (int l = 0; l < lanes; ++l) d[l] = op(a[l], b[l]);
+    }
+}
+
+// Window [x - lo, x + hi] along each row; channels stay separate
+template <typename T, typename Op>
+void horizontalPass(cv::Mat& img, int lo, int hi, Op op, T identity)
+{
+    if (lo == 0 && hi == 0) return;
+    const int cn = img.channels();
+    parallelRows(img.rows, [&](int y0, int y1) {
+        std::vector<T> g, h;
+        for (int y = y0; y < y1; ++y) {
+            T* row = img.ptr<T>(y);
+            vhgwLines(row, cn, row, cn, img.cols, cn, lo, hi, op, identity, g, h);
+        }
+    });
+}
+
+// Window [y - lo, y + hi] down each column, in strips of columns
+template <typename T, typename Op>
+void verticalPass(cv::Mat& img, int lo, int hi, Op op, T identity)
+{
+    if (lo == 0 && hi == 0) return;
+    const int rowLen = img.cols * img.channels();
+    const ptrdiff_t step = static_cast<ptrdiff_t>(img.step1());
+    const int stripLen = 64;
+    const int strips = (rowLen + stripLen - 1) / stripLen;
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range& r) {
+        std::vector<T> g, h;
+        for (int s = r.start; s < r.end; ++s) {
+            int x0 = s * stripLen;
+            T* col = img.ptr<T>(0) + x0;
+            vhgwLines(col, step, col, step, img.rows, std::min(stripLen, rowLen - x0), lo, hi, op, identity, g, h);
+        }
+    });
+}
+
+// Window along the diagonal through (x, y) in direction (1, dir), reach
+// `r` both ways. Rows are sheared so the diagonals become columns, run
+// through the vertical pass, and sheared back.
+template <typename T, typename Op>
+void diagonalPass(cv::Mat& img, int dir, int r, Op op, T identity)
+{
+    if (r == 0) return;
+    const int cn = img.channels();
+    cv::Mat sheared = matPool().acquire(img.rows, img.cols + img.rows, img.type());
+    sheared.setTo(cv::Scalar::all(static_cast<double>(identity)));
+
+    // Row y starts at column offset(y); then (x + t, y + t * dir) lands in
+    // the same column for every t
+    auto offset = [&](int y) { return dir > 0 ? img.rows - 1 - y : y; };
+    parallelRows(img.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y)
+            std::copy(img.ptr<T>(y), img.ptr<T>(y) + img.cols * cn, sheared.ptr<T>(y) + offset(y) * cn);
+    });
+    verticalPass(sheared, r, r, op, identity);
+    parallelRows(img.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const T* s = sheared.ptr<T>(y) + offset(y) * cn;
+            std::copy(s, s + img.cols * cn, img.ptr<T>(y));
+        }
+    });
+}
+
+// Octagon of radius r as horizontal + vertical lines of half-length a and
+// two diagonal lines of half-length b: reaches r along the axes and a + b
+// (~r / sqrt(2)) along the diagonals. The closest polygon to a disk that
+// lines in four directions can build.
+inline void octagonLines(int r, int& a, int& b)
+{
+    b = static_cast<int>(std::lround(r * (1.0 - 1.0 / std::sqrt(2.0))));
+    a = r - 2 * b;
+}
+
+// Erosion (MinOp) or dilation (MaxOp) of `img` in place
+template <typename T, typename Op>
+void flatMorph(cv::Mat& img, int shape, cv::Size ksize, int iterations, Op op, T identity)
+{
+    if (shape == cv::MORPH_RECT) {
+        // k x k repeated n times = one ((k - 1) * n + 1) rectangle
+        int ax = ksize.width / 2, ay = ksize.height / 2;
+        horizontalPass(img, ax * iterations, (ksize.width - 1 - ax) * iterations, op, identity);
+        verticalPass(img, ay * iterations, (ksize.height - 1 - ay) * iterations, op, identity);
+    } else {
+        // Convex elements: n iterations = the element scaled by n
+        int a, b;
+        octagonLines(ksize.width / 2 * iterations, a, b);
+        horizontalPass(img, a, a, op, identity);
+        verticalPass(img, a, a, op, identity);
+        diagonalPass(img, 1, b, op, identity);
+        diagonalPass(img, -1, b, op, identity);
+    }
+}
+
+}  // namespace morph
+
+// ---------------------------------- //
+// ------- ^LINE MORPHOLOGY^ -------- //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// -------- FAST MORPHOLOGY --------- //
+// ---------------------------------- //
+
+// Below this size an ellipse stays on OpenCV's exact mask; it is cheap
+// there and the octagon is a coarse stand-in for a small disk
+static const int kOctagonMinSize = 15;
+
+// Drop-in for cv::morphologyEx(src, dst, op, getStructuringElement(shape,
+// ksize), Point(-1, -1), iterations) with the cost per pixel independent of
+// the element size and of `iterations`:
+//  - MORPH_RECT: exact, separable running min/max
+//  - MORPH_ELLIPSE (square, >= kOctagonMinSize): approximated by an octagon
+//    from four line passes
+// Anything else (crosses, other ops, 8S and 64F data) goes to OpenCV.
+inline void fastMorphology(const cv::Mat& src, cv::Mat& dst, int op, int shape, cv::Size ksize, int iterations = 1)
+{
+    bool rect = shape == cv::MORPH_RECT;
+    bool octagon = shape == cv::MORPH_ELLIPSE && ksize.width == ksize.height && ksize.width >= kOctagonMinSize;
+    bool supportedOp = op == cv::MORPH_ERODE || op == cv::MORPH_DILATE || op == cv::MORPH_OPEN ||
+                       op == cv::MORPH_CLOSE || op == cv::MORPH_TOPHAT || op == cv::MORPH_BLACKHAT ||
+                       op == cv::MORPH_GRADIENT;
+    if ((!rect && !octagon) || !supportedOp || src.depth() == CV_64F || src.depth() == CV_8S || iterations < 1) {
+        cv::morphologyEx(src, dst, op, cv::getStructuringElement(shape, ksize), cv::Point(-1, -1), iterations);
+        return;
+    }
+
+    cv::Mat out = matPool().copyOf(src);
+    cv::Mat second;  // other half of gradient
+    dispatchPixelFormat(src.type(), [&](auto fmt) {
+        typedef typename decltype(fmt)::value_type T;
+        const T hiVal = std::numeric_limits<T>::max();
+        const T loVal = std::numeric_limits<T>::lowest();
+        auto erode = [&](cv::Mat& m) { morph::flatMorph<T>(m, shape, ksize, iterations, morph::MinOp(), hiVal); };
+        auto dilate = [&](cv::Mat& m) { morph::flatMorph<T>(m, shape, ksize, iterations, morph::MaxOp(), loVal); };
+
+        switch (op) {
+        case cv::MORPH_ERODE:    erode(out); break;
+        case cv::MORPH_DILATE:   dilate(out); break;
+        case cv::MORPH_OPEN:
+        case cv::MORPH_TOPHAT:   erode(out); dilate(out); break;
+        case cv::MORPH_CLOSE:
+        case cv::MORPH_BLACKHAT: dilate(out); erode(out); break;
+        case cv::MORPH_GRADIENT:
+            second = matPool().copyOf(src);
+            dilate(out);
+            erode(second);
+            break;
+        }
+    });
+
+    if (op == cv::MORPH_TOPHAT) cv::subtract(src, out, out);
+    else if (op == cv::MORPH_BLACKHAT) cv::subtract(out, src, out);
+    else if (op == cv::MORPH_GRADIENT) cv::subtract(out, second, out);
+    dst = out;
+}
+
+// ---------------------------------- //
+// ------- ^FAST MORPHOLOGY^ -------- //
+// ---------------------------------- //
@@ -40,10 +40,11 @@ void OpenImage(GLuint& imageTexture, int& imageWidth, int& imageHeight) {
         if (img.empty()) {
             std::cerr << "Failed to load image." << std::endl;
         } else {
-            originalImage = img.clone();
-            currentImage = img.clone();
+            // The document and the texture upload share the pixels read from disk;
+            // OpenGL reads them in BGR order, so no conversion is needed
+            originalImage = ImageHandle(img);
+            currentImage = originalImage;
 
-            cv::cvtColor(img, img, cv::COLOR_BGR2RGB); // OpenGL wants RGB
             //std::cout << "Channels: " << img.channels() << std::endl;
 
             imageWidth = img.cols;
@@ -53,7 +54,7 @@ void OpenImage(GLuint& imageTexture, int& imageWidth, int& imageHeight) {
             glGenTextures(1, &imageTexture);
             glBindTexture(GL_TEXTURE_2D, imageTexture);
             glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, img.data);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, img.data);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             glBindTexture(GL_TEXTURE_2D, 0);
@@ -80,7 +81,7 @@ void UpdateTextureFromMat(const cv::Mat& img, GLuint& imageTexture, int& imageWi
     glGenTextures(1, &imageTexture);
     glBindTexture(GL_TEXTURE_2D, imageTexture);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, img.data);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, img.data);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glBindTexture(GL_TEXTURE_2D, 0);
@@ -0,0 +1,1409 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "builtin_recipes.h"
+#include "flatfield.h"
+#include "functiondec.h"
+
+
+// ---------------------------------- //
+// ---------- IMAGE TRAITS ---------- //
+// ---------------------------------- //
+
+// What has been done to an image so far. Stages declare which traits they
+// need and which they add, instead of hand-tracked bools in the GUI.
+enum ImageTrait {
+    TRAIT_NONE           = 0,
+    TRAIT_SINGLE_CHANNEL = 1 << 0,
+    TRAIT_GRAYSCALE      = 1 << 1,
+    TRAIT_BINARY         = 1 << 2,
+    TRAIT_SEGMENTED      = 1 << 3,
+};
+
+// ---------------------------------- //
+// --------- ^IMAGE TRAITS^ --------- //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// ------------- STAGES ------------- //
+// ---------------------------------- //
+
+typedef std::map<std::string, double> StageParams;
+
+// A value flowing along one edge of the pipeline graph
+struct PipelineValue {
+    cv::Mat image;
+    WatershedOutput segmentation{};    // set by the watershed stages
+    std::vector<double> measurements;  // per-object values, e.g. NSI
+    int traits = TRAIT_NONE;
+};
+
+// What to show or save for a value. Segmentation stages output the markers
+// themselves as the image; they are colourized here, only when someone looks.
+inline cv::Mat displayImage(const PipelineValue& value)
+{
+    if (!value.image.empty() && value.image.data == value.segmentation.markers.data)
+        return colorizeMarkers(value.segmentation.markers);
+    return value.image;
+}
+
+// Row kernel for stages that are a pure per-pixel map on CV_8UC3 data.
+// Must tolerate src == dst so fused chains can run in place.
+typedef std::function<void(const uchar* src, uchar* dst, int width, const StageParams& params)> PixelKernel;
+
+struct StageOp {
+    std::string name;
+    int inputs = 1;
+    int requiredTraits = TRAIT_NONE;  // the first input must carry all of these
+    int addedTraits = TRAIT_NONE;
+    int removedTraits = TRAIT_NONE;
+    StageParams defaults;             // declared parameters; recipes may only set these
+    std::function<PipelineValue(const std::vector<PipelineValue>& in, const StageParams& params)> run;
+    PixelKernel pixel;                                    // empty when not per-pixel
+    std::function<bool(const StageParams&)> perPixelWhen; // empty = always, when pixel is set
+};
+
+inline WatershedParams watershedParamsFrom(const StageParams& p)
+{
+    WatershedParams params;
+    params.openIterations = static_cast<int>(p.at("open_iterations"));
+    params.dilateIterations = static_cast<int>(p.at("dilate_iterations"));
+    params.thresholdFraction = p.at("threshold_fraction");
+    params.closingKernel = static_cast<int>(p.at("closing_kernel"));
+    params.minObjectArea = static_cast<int>(p.at("min_object_area"));
+    return params;
+}
+
+inline StageParams watershedStageDefaults(const WatershedParams& params)
+{
+    return {
+        { "open_iterations", params.openIterations },
+        { "dilate_iterations", params.dilateIterations },
+        { "threshold_fraction", params.thresholdFraction },
+        { "closing_kernel", params.closingKernel },
+        { "min_object_area", params.minObjectArea },
+    };
+}
+
+inline PipelineValue withImage(const PipelineValue& in, const cv::Mat& image)
+{
+    PipelineValue out = in;
+    out.image = image;
+    return out;
+}
+
+// Single-channel scratch row for pixel kernels that compute through the SIMD
+// row kernels, then spread the result back over B, G and R
+inline uchar* scratchRow(int width)
+{
+    thread_local std::vector<uchar> row;
+    if (static_cast<int>(row.size()) < width) row.resize(width);
+    return row.data();
+}
+
+inline void replicateRow(const uchar* row, uchar* dst, int width)
+{
+    for (int x = 0; x < width; ++x, dst += 3) {
+        dst[0] = row[x]; dst[1] = row[x]; dst[2] = row[x];
+    }
+}
+
+inline const std::map<std::string, StageOp>& stageRegistry()
+{
+    static const std::map<std::string, StageOp> registry = [] {
+        std::map<std::string, StageOp> ops;
+
+        StageOp flat;
+        flat.name = "flat_field";
+        // reference: id from registerFlatField(); 0 = none, passes the image through
+        flat.defaults = { { "reference", 0.0 } };
+        flat.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            int64_t id = static_cast<int64_t>(p.at("reference"));
+            if (id == 0) return in[0];
+            std::shared_ptr<const FlatField> reference = flatFieldReference(id);
+            if (!reference)
+                CV_Error(cv::Error::StsBadArg, "Unknown flat-field reference " + std::to_string(id));
+            cv::Mat corrected = matPool().acquire(in[0].image.size(), in[0].image.type());
+            reference->apply(in[0].image, corrected);
+            return withImage(in[0], corrected);
+        };
+        ops[flat.name] = flat;
+
+        StageOp channel;
+        channel.name = "isolate_channel";
+        channel.addedTraits = TRAIT_SINGLE_CHANNEL;
+        channel.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            return withImage(in[0], showBlueChannelOnly(in[0].image));
+        };
+        // Only blue kept (same as showBlueChannelOnly)
+        channel.pixel = [](const uchar* src, uchar* dst, int width, const StageParams&) {
+            for (int x = 0; x < width; ++x, src += 3, dst += 3) {
+                uchar b = src[0];
+                dst[0] = b; dst[1] = 0; dst[2] = 0;
+            }
+        };
+        ops[channel.name] = channel;
+
+        StageOp gray;
+        gray.name = "grayscale";
+        gray.addedTraits = TRAIT_GRAYSCALE;
+        gray.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            return withImage(in[0], toGrayscale(in[0].image));
+        };
+        // cvtColor(BGR2GRAY) fixed-point weights, replicated back to 3 channels
+        gray.pixel = [](const uchar* src, uchar* dst, int width, const StageParams&) {
+            uchar* g = scratchRow(width);
+            simd::kernels().bgrToGray8u(src, g, width, 3);
+            replicateRow(g, dst, width);
+        };
+        ops[gray.name] = gray;
+
+        StageOp blur;
+        blur.name = "gaussian_blur";
+        blur.removedTraits = TRAIT_BINARY;
+        blur.defaults = { { "sigma", 3.0 }, { "mode", BLUR_GAUSSIAN } };  // mode 1 = recursive
+        blur.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            return withImage(in[0], gaussianFilter(in[0].image, p.at("sigma"), static_cast<int>(p.at("mode"))));
+        };
+        ops[blur.name] = blur;
+
+        StageOp background;
+        background.name = "subtract_background";
+        background.removedTraits = TRAIT_BINARY;
+        // method: 0 = off (passes the image through), 1 = top-hat, 2 = blur
+        background.defaults = { { "method", BACKGROUND_TOPHAT }, { "radius", 50.0 } };
+        background.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            return withImage(in[0], subtractBackground(in[0].image, static_cast<int>(p.at("method")),
+                                                       static_cast<int>(p.at("radius"))));
+        };
+        ops[background.name] = background;
+
+        // Component-tree filter (include/maxtree.h): removes whole bright
+        // components (dark ones with closing: 1) that fail the criteria
+        StageOp attribute;
+        attribute.name = "attribute_filter";
+        AttributeFilter attributeDefaults;
+        attribute.defaults = { { "min_area", 100.0 },
+                               { "max_area", attributeDefaults.maxArea },
+                               { "max_elongation", attributeDefaults.maxElongation },
+                               { "closing", 0.0 } };
+        attribute.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            AttributeFilter criteria;
+            criteria.minArea = static_cast<int>(p.at("min_area"));
+            criteria.maxArea = static_cast<int>(p.at("max_area"));
+            criteria.maxElongation = p.at("max_elongation");
+            cv::Mat filtered;
+            attributeFilter(in[0].image, filtered, criteria, p.at("closing") != 0);
+            return withImage(in[0], filtered);
+        };
+        ops[attribute.name] = attribute;
+
+        StageOp thresh;
+        thresh.name = "threshold";
+        thresh.addedTraits = TRAIT_BINARY;
+        // threshold < 0 = Otsu; method > 0 = local (mean-C, Niblack, Sauvola)
+        LocalThreshold localDefaults;
+        thresh.defaults = { { "threshold", -1.0 },
+                            { "method", localDefaults.method },
+                            { "window", localDefaults.window },
+                            { "k", localDefaults.k },
+                            { "offset", localDefaults.offset } };
+        thresh.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            LocalThreshold local;
+            local.method = static_cast<int>(p.at("method"));
+            local.window = static_cast<int>(p.at("window"));
+            local.k = p.at("k");
+            local.offset = p.at("offset");
+            return withImage(in[0], intensityThreshold(in[0].image, p.at("threshold"), local));
+        };
+        // Only a fixed level is per-pixel; Otsu needs the whole histogram first
+        thresh.pixel = [](const uchar* src, uchar* dst, int width, const StageParams& p) {
+            double level = p.at("threshold");
+            uchar* g = scratchRow(width);
+            const simd::KernelTable& k = simd::kernels();
+            k.bgrToGray8u(src, g, width, 3);
+            if (level >= 255)
+                std::memset(g, 0, width);
+            else
+                k.threshold8u(g, g, width, static_cast<uchar>(level));
+            replicateRow(g, dst, width);
+        };
+        thresh.perPixelWhen = [](const StageParams& p) {
+            return p.at("threshold") >= 0 && p.at("method") == LOCAL_THRESH_NONE;
+        };
+        ops[thresh.name] = thresh;
+
+        StageOp wsOpenCV;
+        wsOpenCV.name = "watershed_opencv";
+        wsOpenCV.requiredTraits = TRAIT_SINGLE_CHANNEL | TRAIT_GRAYSCALE | TRAIT_BINARY;
+        wsOpenCV.addedTraits = TRAIT_SEGMENTED;
+        wsOpenCV.defaults = watershedStageDefaults(WatershedParams());
+        wsOpenCV.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            PipelineValue out = in[0];
+            out.segmentation = runWatershed(in[0].image, watershedParamsFrom(p));
+            out.image = out.segmentation.markers;
+            return out;
+        };
+        ops[wsOpenCV.name] = wsOpenCV;
+
+        StageOp wsCustom = wsOpenCV;
+        wsCustom.name = "watershed_custom";
+        wsCustom.defaults = watershedStageDefaults(customWatershedDefaults());
+        wsCustom.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            PipelineValue out = in[0];
+            out.segmentation = runCustomWatershed(in[0].image, watershedParamsFrom(p));
+            out.image = out.segmentation.markers;
+            return out;
+        };
+        ops[wsCustom.name] = wsCustom;
+
+        StageOp wsPriority = wsCustom;
+        wsPriority.name = "watershed_priority";
+        wsPriority.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            PipelineValue out = in[0];
+            out.segmentation = runPriorityWatershed(in[0].image, watershedParamsFrom(p));
+            out.image = out.segmentation.markers;
+            return out;
+        };
+        ops[wsPriority.name] = wsPriority;
+
+        StageOp wsCoarse = wsCustom;
+        wsCoarse.name = "watershed_coarse";
+        wsCoarse.defaults["factor"] = 4;  // coarse pass at 1/factor scale, 1 = plain custom engine
+        wsCoarse.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            PipelineValue out = in[0];
+            out.segmentation = runCoarseWatershed(in[0].image, watershedParamsFrom(p), static_cast<int>(p.at("factor")));
+            out.image = out.segmentation.markers;
+            return out;
+        };
+        ops[wsCoarse.name] = wsCoarse;
+
+        // Decomposed watershed. Recipes built from these keep every
+        // intermediate addressable, so a session can re-run only the steps
+        // downstream of a changed parameter (e.g. the foreground fraction
+        // leaves the opening and distance transform untouched).
+        StageOp wsOpening;
+        wsOpening.name = "ws_opening";
+        wsOpening.requiredTraits = TRAIT_SINGLE_CHANNEL | TRAIT_GRAYSCALE | TRAIT_BINARY;
+        wsOpening.defaults = {
+            { "iterations", WatershedParams().openIterations },
+            { "min_area", WatershedParams().minObjectArea },
+        };
+        wsOpening.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            return withImage(in[0], watershedOpening(in[0].image, static_cast<int>(p.at("iterations")),
+                                                     static_cast<int>(p.at("min_area"))));
+        };
+        ops[wsOpening.name] = wsOpening;
+
+        StageOp wsSureBg;
+        wsSureBg.name = "ws_sure_background";
+        wsSureBg.defaults = { { "iterations", WatershedParams().dilateIterations } };
+        wsSureBg.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            return withImage(in[0], watershedSureBackground(in[0].image, static_cast<int>(p.at("iterations"))));
+        };
+        ops[wsSureBg.name] = wsSureBg;
+
+        StageOp wsDistance;
+        wsDistance.name = "ws_distance";
+        wsDistance.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            return withImage(in[0], watershedDistance(in[0].image));
+        };
+        ops[wsDistance.name] = wsDistance;
+
+        StageOp wsSureFg;
+        wsSureFg.name = "ws_sure_foreground";
+        wsSureFg.defaults = {
+            { "threshold_fraction", WatershedParams().thresholdFraction },
+            { "closing_kernel", WatershedParams().closingKernel },
+        };
+        wsSureFg.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            return withImage(in[0], watershedSureForeground(in[0].image, p.at("threshold_fraction"),
+                                                            static_cast<int>(p.at("closing_kernel"))));
+        };
+        ops[wsSureFg.name] = wsSureFg;
+
+        // inputs: [ sure background, sure foreground ]
+        StageOp wsMarkers;
+        wsMarkers.name = "ws_markers";
+        wsMarkers.inputs = 2;
+        wsMarkers.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            return withImage(in[0], watershedSeedMarkers(in[0].image, in[1].image));
+        };
+        ops[wsMarkers.name] = wsMarkers;
+
+        // inputs: [ binary image, markers ]. The flood writes into the markers,
+        // so it works on a copy; the input may be shared with a cache or session.
+        StageOp wsFloodOpenCV;
+        wsFloodOpenCV.name = "ws_flood_opencv";
+        wsFloodOpenCV.inputs = 2;
+        wsFloodOpenCV.requiredTraits = TRAIT_BINARY;
+        wsFloodOpenCV.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            cv::Mat markers = matPool().copyOf(in[1].image);
+            floodOpenCV(in[0].image, markers);
+            return withImage(in[1], markers);
+        };
+        ops[wsFloodOpenCV.name] = wsFloodOpenCV;
+
+        StageOp wsFloodBFS;
+        wsFloodBFS.name = "ws_flood_bfs";
+        wsFloodBFS.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            cv::Mat markers = matPool().copyOf(in[0].image);
+            floodBFS(markers);
+            return withImage(in[0], markers);
+        };
+        ops[wsFloodBFS.name] = wsFloodBFS;
+
+        // inputs: [ landscape, markers ]. The landscape is the distance
+        // transform or the blurred image; higher values are flooded first.
+        StageOp wsFloodPriority;
+        wsFloodPriority.name = "ws_flood_priority";
+        wsFloodPriority.inputs = 2;
+        wsFloodPriority.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            cv::Mat markers = matPool().copyOf(in[1].image);
+            floodPriority(in[0].image, markers);
+            return withImage(in[1], markers);
+        };
+        ops[wsFloodPriority.name] = wsFloodPriority;
+
+        // Re-segments regions whose area is an outlier (merged nuclei);
+        // mad_factor 0 passes the markers through
+        StageOp wsSplit;
+        wsSplit.name = "ws_split_large";
+        SplitParams splitDefaults;
+        wsSplit.defaults = { { "mad_factor", splitDefaults.madFactor },
+                             { "threshold_fraction", splitDefaults.thresholdFraction } };
+        wsSplit.run = [](const std::vector<PipelineValue>& in, const StageParams& p) {
+            SplitParams params;
+            params.madFactor = p.at("mad_factor");
+            params.thresholdFraction = p.at("threshold_fraction");
+            if (params.madFactor <= 0) return in[0];
+            cv::Mat markers = matPool().copyOf(in[0].image);
+            splitLargeRegions(markers, params);
+            return withImage(in[0], markers);
+        };
+        ops[wsSplit.name] = wsSplit;
+
+        // Counts and compacts the flooded markers; colourized only on display
+        StageOp wsFinish;
+        wsFinish.name = "ws_finish";
+        wsFinish.addedTraits = TRAIT_SEGMENTED;
+        wsFinish.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            PipelineValue out = in[0];
+            out.segmentation = finishMarkers(in[0].image);
+            out.image = out.segmentation.markers;
+            return out;
+        };
+        ops[wsFinish.name] = wsFinish;
+
+        StageOp nsi;
+        nsi.name = "nsi";
+        nsi.requiredTraits = TRAIT_SEGMENTED;
+        nsi.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            PipelineValue out = in[0];
+            out.measurements = calculateNSI(in[0].segmentation.markers);
+            out.image = drawNSILabels(in[0].segmentation.markers);
+            return out;
+        };
+        ops[nsi.name] = nsi;
+
+        // inputs: [ segmentation, nsi ]
+        StageOp heatmap;
+        heatmap.name = "nsi_heatmap";
+        heatmap.inputs = 2;
+        heatmap.requiredTraits = TRAIT_SEGMENTED;
+        heatmap.run = [](const std::vector<PipelineValue>& in, const StageParams&) {
+            // One set of runs for the colours and, if the NSI input carries
+            // none for these objects, for the NSI itself
+            PipelineValue out = in[0];
+            const LabelRuns objects(in[0].segmentation.markers);
+            out.measurements = static_cast<int>(in[1].measurements.size()) == objects.count()
+                             ? in[1].measurements : calculateNSI(objects);
+            out.image = createNSIHeatmap(objects, out.measurements);
+            return out;
+        };
+        ops[heatmap.name] = heatmap;
+
+        return ops;
+    }();
+    return registry;
+}
+
+inline const StageOp& findStageOp(const std::string& name)
+{
+    auto it = stageRegistry().find(name);
+    if (it == stageRegistry().end())
+        CV_Error(cv::Error::StsBadArg, "Unknown pipeline stage '" + name + "'");
+    return it->second;
+}
+
+inline bool stageAccepts(const std::string& op, int traits)
+{
+    int required = findStageOp(op).requiredTraits;
+    return (traits & required) == required;
+}
+
+// ---------------------------------- //
+// ------------ ^STAGES^ ------------ //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// ---------- STAGE CACHE ----------- //
+// ---------------------------------- //
+
+// Bump, in the same change, whenever a stage's output changes for the same
+// input and parameters (values, type or layout), so results persisted on
+// disk by an older build are not reused.
+static const uint64_t kStageCacheVersion = 6;
+
+inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27; x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+    return mix64(seed ^ mix64(value + 0x9E3779B97F4A7C15ull));
+}
+
+// Word-at-a-time multiply/rotate hash; not cryptographic, just fast
+inline uint64_t hashBytes(const void* data, size_t len, uint64_t seed)
+{
+    const uchar* p = static_cast<const uchar*>(data);
+    uint64_t h = seed ^ (len * 0x9E3779B97F4A7C15ull);
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t k;
+        std::memcpy(&k, p + i, 8);
+        h ^= k * 0x87C37B91114253D5ull;
+        h = ((h << 31) | (h >> 33)) * 0x4CF5AD432745937Full;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, p + i, len - i);
+    h ^= tail * 0x87C37B91114253D5ull;
+    return mix64(h);
+}
+
+// Content hash of the pixels (plus geometry and type). Strips of rows are
+// hashed in parallel and folded in order, so the result is thread-count stable.
+inline uint64_t hashMat(const cv::Mat& m)
+{
+    uint64_t h = hashCombine(hashCombine(hashCombine(kStageCacheVersion, m.rows), m.cols), m.type());
+    if (m.empty()) return h;
+
+    const int stripRows = 64;
+    const int strips = (m.rows + stripRows - 1) / stripRows;
+    const size_t rowBytes = m.cols * m.elemSize();
+    std::vector<uint64_t> stripHash(strips);
+
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range& range) {
+        for (int s = range.start; s < range.end; ++s) {
+            uint64_t sh = static_cast<uint64_t>(s);
+            int last = std::min(m.rows, (s + 1) * stripRows);
+            for (int y = s * stripRows; y < last; ++y) sh = hashBytes(m.ptr(y), rowBytes, sh);
+            stripHash[s] = sh;
+        }
+    });
+
+    for (uint64_t sh : stripHash) h = hashCombine(h, sh);
+    return h;
+}
+
+// Makes a flat-field reference available to the flat_field stage and
+// returns the id to put in its `reference` parameter. The id is a content
+// hash (52 bits, so it survives as a double parameter): the same reference
+// gets the same id in every run, and stage results cached on disk are only
+// reused with the reference they were made with.
+inline int64_t registerFlatField(const FlatField& reference)
+{
+    CV_Assert(!reference.empty());
+    uint64_t h = hashCombine(hashMat(reference.gainMap()), hashMat(reference.offsetMap()));
+    int64_t id = static_cast<int64_t>(h & ((uint64_t(1) << 52) - 1)) | 1;
+    storeFlatField(id, reference);
+    return id;
+}
+
+inline uint64_t hashPipelineValue(const PipelineValue& value)
+{
+    uint64_t h = hashCombine(hashMat(value.image), static_cast<uint64_t>(value.traits));
+    if (!value.segmentation.markers.empty() && value.segmentation.markers.data != value.image.data)
+        h = hashCombine(h, hashMat(value.segmentation.markers));
+    if (!value.measurements.empty())
+        h = hashBytes(value.measurements.data(), value.measurements.size() * sizeof(double), h);
+    return h;
+}
+
+// Address of a stage's output: its inputs' addresses, the op and its params.
+// A fused chain gets the same address as running its stages one by one.
+inline uint64_t stageKey(const std::string& op, const StageParams& params, uint64_t inputKey)
+{
+    uint64_t h = hashBytes(op.data(), op.size(), inputKey);
+    for (const auto& [name, value] : params) {
+        h = hashBytes(name.data(), name.size(), h);
+        h = hashBytes(&value, sizeof(value), h);
+    }
+    return h;
+}
+
+inline uint64_t inputsKey(const std::vector<uint64_t>& keys)
+{
+    if (keys.size() == 1) return keys[0];
+    uint64_t h = kStageCacheVersion;
+    for (uint64_t k : keys) h = hashCombine(h, k);
+    return h;
+}
+
+inline void writeCachedMat(std::ofstream& out, const cv::Mat& m)
+{
+    int header[3] = { m.rows, m.cols, m.type() };
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    const size_t rowBytes = m.cols * m.elemSize();
+    for (int y = 0; y < m.rows; ++y)
+        out.write(reinterpret_cast<const char*>(m.ptr(y)), rowBytes);
+}
+
+// Bytes from the read position to the end of the file, -1 on a bad stream
+inline int64_t cachedBytesLeft(std::ifstream& in)
+{
+    const std::streampos at = in.tellg();
+    if (at < 0 || !in.seekg(0, std::ios::end)) return -1;
+    const int64_t left = static_cast<int64_t>(in.tellg() - at);
+    in.seekg(at);
+    return in ? left : -1;
+}
+
+// False on a header the file cannot hold (truncated or corrupt entry)
+inline bool readCachedMat(std::ifstream& in, cv::Mat& m)
+{
+    int header[3];
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+    const int rows = header[0], cols = header[1], type = header[2];
+    if (rows == 0 && cols == 0) {
+        m.release();
+        return true;
+    }
+    if (rows <= 0 || cols <= 0 || type < 0 || type != CV_MAT_TYPE(type)) return false;
+
+    const int64_t left = cachedBytesLeft(in);
+    const uint64_t pixels = static_cast<uint64_t>(rows) * static_cast<uint64_t>(cols);
+    if (left < 0 || pixels > static_cast<uint64_t>(left) ||
+        pixels * CV_ELEM_SIZE(type) > static_cast<uint64_t>(left))
+        return false;
+
+    m.create(rows, cols, type);
+    in.read(reinterpret_cast<char*>(m.data), m.total() * m.elemSize());
+    return static_cast<bool>(in);
+}
+
+// Memoizes stage outputs by content address. Keeps the most recently used
+// results within a byte budget and, when given a directory, also persists
+// them so a later session or batch run can skip the work entirely.
+class StageCache {
+public:
+    explicit StageCache(size_t budgetBytes = size_t(512) << 20) : budget(budgetBytes) {}
+
+    bool get(uint64_t key, PipelineValue& out)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                lru.splice(lru.begin(), lru, it->second.position);
+                out = it->second.value;
+                ++hits;
+                return true;
+            }
+        }
+
+        std::string dir = directory();
+        if (!dir.empty() && readEntry(entryPath(dir, key), out)) {
+            insert(key, out);
+            std::lock_guard<std::mutex> lock(mutex);
+            ++hits;
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        ++misses;
+        return false;
+    }
+
+    void put(uint64_t key, const PipelineValue& value)
+    {
+        insert(key, value);
+        std::string dir = directory();
+        if (!dir.empty()) writeEntry(entryPath(dir, key), value);
+    }
+
+    void setBudget(size_t budgetBytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = budgetBytes;
+        evictToBudget();
+    }
+
+    // Empty string turns persistence off
+    void setDirectory(const std::string& dir)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        diskDirectory = dir;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        lru.clear();
+        used = 0;
+    }
+
+    size_t bytesUsed() const { std::lock_guard<std::mutex> lock(mutex); return used; }
+    size_t hitCount() const { std::lock_guard<std::mutex> lock(mutex); return hits; }
+    size_t missCount() const { std::lock_guard<std::mutex> lock(mutex); return misses; }
+
+private:
+    struct Entry {
+        PipelineValue value;
+        size_t bytes = 0;
+        std::list<uint64_t>::iterator position;
+    };
+
+    // Distinct pixel buffers held by a value (the markers may alias `image`)
+    static size_t valueBytes(const PipelineValue& v)
+    {
+        std::set<const uchar*> seen;
+        size_t bytes = v.measurements.size() * sizeof(double);
+        for (const cv::Mat* m : { &v.image, &v.segmentation.markers }) {
+            if (!m->empty() && seen.insert(m->datastart).second)
+                bytes += m->step[0] * m->rows;
+        }
+        return bytes;
+    }
+
+    void insert(uint64_t key, const PipelineValue& value)
+    {
+        size_t bytes = valueBytes(value);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (bytes > budget) return;
+
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            used -= it->second.bytes;
+            lru.erase(it->second.position);
+            entries.erase(it);
+        }
+        lru.push_front(key);
+        entries[key] = Entry{ value, bytes, lru.begin() };
+        used += bytes;
+        evictToBudget();
+    }
+
+    void evictToBudget()
+    {
+        while (used > budget && !lru.empty()) {
+            auto it = entries.find(lru.back());
+            used -= it->second.bytes;
+            entries.erase(it);
+            lru.pop_back();
+        }
+    }
+
+    std::string directory() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return diskDirectory;
+    }
+
+    static std::string entryPath(const std::string& dir, uint64_t key)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.stage", static_cast<unsigned long long>(key));
+        return dir + "/" + name;
+    }
+
+    static bool readEntry(const std::string& path, PipelineValue& out)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+
+        uint64_t magic = 0;
+        int header[3] = { 0, 0, 0 };  // traits, object count, measurement count
+        in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!in || magic != (0x43595453ull ^ kStageCacheVersion)) return false;
+
+        // A corrupt count must be a cache miss, not a huge allocation
+        const int64_t left = cachedBytesLeft(in);
+        if (header[1] < 0 || header[2] < 0 || left < 0 ||
+            static_cast<uint64_t>(header[2]) * sizeof(double) > static_cast<uint64_t>(left))
+            return false;
+
+        PipelineValue value;
+        value.traits = header[0];
+        value.segmentation.count = header[1];
+        value.measurements.resize(header[2]);
+        if (!in.read(reinterpret_cast<char*>(value.measurements.data()), header[2] * sizeof(double))) return false;
+
+        // The alias is restored so displayImage() still recognises the markers
+        char aliased = 0;
+        if (!readCachedMat(in, value.image)) return false;
+        if (!in.read(&aliased, 1)) return false;
+        if (aliased)
+            value.segmentation.markers = value.image;
+        else if (!readCachedMat(in, value.segmentation.markers))
+            return false;
+
+        out = value;
+        return true;
+    }
+
+    static void writeEntry(const std::string& path, const PipelineValue& value)
+    {
+        // Write then rename, so a concurrent reader never sees half an entry
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary);
+            if (!out) return;
+            uint64_t magic = 0x43595453ull ^ kStageCacheVersion;
+            int header[3] = { value.traits, value.segmentation.count, static_cast<int>(value.measurements.size()) };
+            out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+            out.write(reinterpret_cast<const char*>(header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(value.measurements.data()), value.measurements.size() * sizeof(double));
+
+            writeCachedMat(out, value.image);
+            char aliased = !value.image.empty() && value.segmentation.markers.data == value.image.data ? 1 : 0;
+            out.write(&aliased, 1);
+            if (!aliased) writeCachedMat(out, value.segmentation.markers);
+        }
+        std::remove(path.c_str());
+        std::rename(tmp.c_str(), path.c_str());
+    }
+
+    size_t budget;
+    size_t used = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    std::string diskDirectory;
+    std::list<uint64_t> lru;  // most recent first
+    std::map<uint64_t, Entry> entries;
+    mutable std::mutex mutex;
+};
+
+// Process-wide cache shared by the GUI actions and pipelines
+inline StageCache& stageCache()
+{
+    static StageCache cache;
+    return cache;
+}
+
+// ---------------------------------- //
+// ---------- ^STAGE CACHE^ --------- //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// ------------ RECIPES ------------- //
+// ---------------------------------- //
+
+// One node of the graph. Its output value is named by `id`; the image the
+// pipeline is run on is the value "input".
+struct StageSpec {
+    std::string id;
+    std::string op;
+    std::vector<std::string> inputs;
+    StageParams params;
+};
+
+struct Recipe {
+    std::string name;
+    std::string output;
+    std::vector<StageSpec> stages;
+};
+
+// Former op names, so older recipe files still load
+inline std::string currentStageOpName(const std::string& op)
+{
+    static const std::map<std::string, std::string> renamed = {
+        { "ws_colorize", "ws_finish" },
+    };
+    auto it = renamed.find(op);
+    return it == renamed.end() ? op : it->second;
+}
+
+inline Recipe parseRecipe(const cv::FileStorage& fs)
+{
+    Recipe recipe;
+    recipe.name = (std::string)fs["name"];
+    recipe.output = (std::string)fs["output"];
+
+    cv::FileNode stages = fs["stages"];
+    for (cv::FileNodeIterator it = stages.begin(); it != stages.end(); ++it) {
+        cv::FileNode node = *it;
+        StageSpec spec;
+        spec.id = (std::string)node["id"];
+        spec.op = currentStageOpName((std::string)node["op"]);
+
+        cv::FileNode inputs = node["inputs"];
+        for (cv::FileNodeIterator in = inputs.begin(); in != inputs.end(); ++in)
+            spec.inputs.push_back((std::string)*in);
+
+        cv::FileNode params = node["params"];
+        for (cv::FileNodeIterator p = params.begin(); p != params.end(); ++p)
+            spec.params[(*p).name()] = (double)*p;
+
+        recipe.stages.push_back(spec);
+    }
+    if (recipe.output.empty() && !recipe.stages.empty())
+        recipe.output = recipe.stages.back().id;
+    return recipe;
+}
+
+// Recipe files are YAML or JSON (anything cv::FileStorage reads)
+inline Recipe loadRecipe(const std::string& path)
+{
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened())
+        CV_Error(cv::Error::StsError, "Cannot open recipe file " + path);
+    return parseRecipe(fs);
+}
+
+inline void saveRecipe(const Recipe& recipe, const std::string& path)
+{
+    cv::FileStorage fs(path, cv::FileStorage::WRITE);
+    fs << "name" << recipe.name;
+    fs << "output" << recipe.output;
+    fs << "stages" << "[";
+    for (const StageSpec& spec : recipe.stages) {
+        fs << "{";
+        fs << "id" << spec.id;
+        fs << "op" << spec.op;
+        fs << "inputs" << "[";
+        for (const std::string& in : spec.inputs) fs << in;
+        fs << "]";
+        if (!spec.params.empty()) {
+            fs << "params" << "{";
+            for (const auto& [key, value] : spec.params) fs << key << value;
+            fs << "}";
+        }
+        fs << "}";
+    }
+    fs << "]";
+}
+
+// Built-in recipes behind Ctrl+1 / Ctrl+2 / Ctrl+3 (and their menu items):
+// the files in recipes/, compiled in by CMake (builtin_recipes.h)
+inline Recipe builtinRecipe(const std::string& name)
+{
+    auto it = kBuiltinRecipeText.find(name);
+    if (it == kBuiltinRecipeText.end())
+        CV_Error(cv::Error::StsBadArg, "Unknown built-in recipe '" + name + "'");
+    cv::FileStorage fs(it->second, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+    return parseRecipe(fs);
+}
+
+// ---------------------------------- //
+// ----------- ^RECIPES^ ------------ //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// ---------- EXECUTION PLAN -------- //
+// ---------------------------------- //
+
+// One unit of work. Holds several recipe stages when adjacent per-pixel
+// stages were fused into a single pass over the image.
+struct PlanStep {
+    std::vector<const StageOp*> ops;
+    std::vector<StageParams> params;   // effective params, one per op
+    std::vector<std::string> inputs;   // values read by the first op
+    std::string output;                // value written by the last op
+    std::vector<std::string> stageIds;
+};
+
+struct ExecutionPlan {
+    std::string name;
+    std::string output;
+    std::vector<std::vector<PlanStep>> waves;  // steps in one wave are independent
+    std::map<std::string, int> lastUse;        // value -> last wave that reads it
+};
+
+inline bool stageIsPerPixel(const StageOp& op, const StageParams& params)
+{
+    return op.pixel && (!op.perPixelWhen || op.perPixelWhen(params));
+}
+
+inline ExecutionPlan compilePipeline(const Recipe& recipe)
+{
+    ExecutionPlan plan;
+    plan.name = recipe.name;
+    plan.output = recipe.output;
+
+    // Validate stages and resolve effective parameters
+    std::map<std::string, int> producer;  // value -> stage index
+    std::vector<StageParams> params(recipe.stages.size());
+    for (size_t i = 0; i < recipe.stages.size(); ++i) {
+        const StageSpec& spec = recipe.stages[i];
+        const StageOp& op = findStageOp(spec.op);
+
+        if (spec.id.empty() || spec.id == "input" || producer.count(spec.id))
+            CV_Error(cv::Error::StsBadArg, "Recipe stage id '" + spec.id + "' is empty or duplicated");
+        if (static_cast<int>(spec.inputs.size()) != op.inputs)
+            CV_Error(cv::Error::StsBadArg, "Stage '" + spec.id + "' has the wrong number of inputs");
+
+        params[i] = op.defaults;
+        for (const auto& [key, value] : spec.params) {
+            if (!op.defaults.count(key))
+                CV_Error(cv::Error::StsBadArg, "Stage '" + spec.id + "' has no parameter '" + key + "'");
+            params[i][key] = value;
+        }
+        producer[spec.id] = static_cast<int>(i);
+    }
+    if (!producer.count(recipe.output))
+        CV_Error(cv::Error::StsBadArg, "Recipe output '" + recipe.output + "' is not produced by any stage");
+
+    // Topological order (Kahn); rejects cycles and dangling inputs
+    std::map<std::string, int> consumers;
+    std::vector<int> pending(recipe.stages.size(), 0);
+    for (size_t i = 0; i < recipe.stages.size(); ++i) {
+        for (const std::string& in : recipe.stages[i].inputs) {
+            consumers[in]++;
+            if (in == "input") continue;
+            if (!producer.count(in))
+                CV_Error(cv::Error::StsBadArg, "Stage '" + recipe.stages[i].id + "' reads unknown value '" + in + "'");
+            pending[i]++;
+        }
+    }
+    std::vector<int> order;
+    std::vector<bool> done(recipe.stages.size(), false);
+    while (order.size() < recipe.stages.size()) {
+        bool progressed = false;
+        for (size_t i = 0; i < recipe.stages.size(); ++i) {
+            if (done[i] || pending[i] > 0) continue;
+            done[i] = true;
+            progressed = true;
+            order.push_back(static_cast<int>(i));
+            for (size_t j = 0; j < recipe.stages.size(); ++j)
+                for (const std::string& in : recipe.stages[j].inputs)
+                    if (in == recipe.stages[i].id) pending[j]--;
+        }
+        if (!progressed)
+            CV_Error(cv::Error::StsBadArg, "Recipe '" + recipe.name + "' contains a cycle");
+    }
+
+    // Build steps, fusing a per-pixel stage into its producer's step when it
+    // is that value's only reader and the value is not the pipeline output
+    std::vector<PlanStep> steps;
+    std::map<std::string, int> stepOf;  // value -> step producing it
+    for (int i : order) {
+        const StageSpec& spec = recipe.stages[i];
+        const StageOp& op = findStageOp(spec.op);
+
+        bool fused = false;
+        if (stageIsPerPixel(op, params[i]) && spec.inputs.size() == 1) {
+            const std::string& in = spec.inputs[0];
+            auto prev = stepOf.find(in);
+            if (prev != stepOf.end() && consumers[in] == 1 && in != recipe.output) {
+                PlanStep& step = steps[prev->second];
+                bool chainIsPerPixel = true;
+                for (size_t k = 0; k < step.ops.size(); ++k)
+                    chainIsPerPixel = chainIsPerPixel && stageIsPerPixel(*step.ops[k], step.params[k]);
+                if (chainIsPerPixel && step.output == in) {
+                    step.ops.push_back(&op);
+                    step.params.push_back(params[i]);
+                    step.output = spec.id;
+                    step.stageIds.push_back(spec.id);
+                    stepOf[spec.id] = prev->second;
+                    fused = true;
+                }
+            }
+        }
+        if (!fused) {
+            PlanStep step;
+            step.ops.push_back(&op);
+            step.params.push_back(params[i]);
+            step.inputs = spec.inputs;
+            step.output = spec.id;
+            step.stageIds.push_back(spec.id);
+            stepOf[spec.id] = static_cast<int>(steps.size());
+            steps.push_back(step);
+        }
+    }
+
+    // Waves: a step runs one wave after the latest step it depends on
+    std::vector<int> waveOf(steps.size(), 0);
+    int waveCount = 0;
+    for (size_t s = 0; s < steps.size(); ++s) {
+        for (const std::string& in : steps[s].inputs)
+            if (in != "input") waveOf[s] = std::max(waveOf[s], waveOf[stepOf[in]] + 1);
+        waveCount = std::max(waveCount, waveOf[s] + 1);
+    }
+    plan.waves.resize(waveCount);
+    for (size_t s = 0; s < steps.size(); ++s) {
+        plan.waves[waveOf[s]].push_back(steps[s]);
+        for (const std::string& in : steps[s].inputs)
+            plan.lastUse[in] = std::max(plan.lastUse.count(in) ? plan.lastUse[in] : 0, waveOf[s]);
+    }
+    return plan;
+}
+
+// ---------------------------------- //
+// --------- ^EXECUTION PLAN^ ------- //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// ----------- EXECUTION ------------ //
+// ---------------------------------- //
+
+// Runs a fused chain of per-pixel kernels in one parallel pass over the rows.
+// Writes in place when the caller hands over the only reference to `src`.
+inline cv::Mat runFusedKernels(const PlanStep& step, cv::Mat src, bool inPlace)
+{
+    cv::Mat dst = inPlace ? src : matPool().acquire(src.size(), src.type());
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const uchar* s = src.ptr<uchar>(y);
+            uchar* d = dst.ptr<uchar>(y);
+            for (size_t k = 0; k < step.ops.size(); ++k) {
+                step.ops[k]->pixel(s, d, src.cols, step.params[k]);
+                s = d;
+            }
+        }
+    });
+    return dst;
+}
+
+inline PipelineValue runStep(const PlanStep& step, std::vector<PipelineValue> in, bool mayReuseInput)
+{
+    int traits = 0;
+    for (const PipelineValue& v : in) traits |= v.traits;
+
+    const StageOp& first = *step.ops[0];
+    if ((traits & first.requiredTraits) != first.requiredTraits)
+        CV_Error(cv::Error::StsBadArg, "Stage '" + step.stageIds[0] + "' is missing pre-requisite processing");
+
+    if (step.ops.size() > 1 && in[0].image.type() == CV_8UC3) {
+        PipelineValue out = in[0];
+        in[0].image.release();
+        // Only overwrite the input when nothing else (caller, history, cache,
+        // another value's alias) still references its buffer. Stage outputs
+        // are pool buffers, so the pool's own reference does not count.
+        bool alone = mayReuseInput && matPool().soleUser(out.image);
+        out.image = runFusedKernels(step, out.image, alone);
+        for (const StageOp* op : step.ops)
+            traits = (traits & ~op->removedTraits) | op->addedTraits;
+        out.traits = traits;
+        return out;
+    }
+
+    PipelineValue value;
+    for (size_t k = 0; k < step.ops.size(); ++k) {
+        const StageOp& op = *step.ops[k];
+        if (k > 0) in = { value };
+        value = op.run(in, step.params[k]);
+        traits = (traits & ~op.removedTraits) | op.addedTraits;
+        value.traits = traits;
+    }
+    return value;
+}
+
+// Run one stage on its own, e.g. for a single GUI menu action
+inline PipelineValue applyStage(const std::string& opName, const std::vector<PipelineValue>& in,
+                                const StageParams& overrides = StageParams(), StageCache* cache = nullptr)
+{
+    const StageOp& op = findStageOp(opName);
+    CV_Assert(static_cast<int>(in.size()) == op.inputs);
+    if (!stageAccepts(opName, in[0].traits))
+        CV_Error(cv::Error::StsBadArg, "Stage '" + opName + "' is missing pre-requisite processing");
+
+    StageParams params = op.defaults;
+    for (const auto& [key, value] : overrides) params[key] = value;
+
+    uint64_t key = 0;
+    if (cache) {
+        std::vector<uint64_t> inKeys;
+        for (const PipelineValue& v : in) inKeys.push_back(hashPipelineValue(v));
+        key = stageKey(opName, params, inputsKey(inKeys));
+        PipelineValue hit;
+        if (cache->get(key, hit)) return hit;
+    }
+
+    PipelineValue out = op.run(in, params);
+    int traits = 0;
+    for (const PipelineValue& v : in) traits |= v.traits;
+    out.traits = (traits & ~op.removedTraits) | op.addedTraits;
+
+    if (cache) cache->put(key, out);
+    return out;
+}
+
+inline PipelineValue applyStage(const std::string& opName, const PipelineValue& in,
+                                const StageParams& overrides = StageParams(), StageCache* cache = nullptr)
+{
+    return applyStage(opName, std::vector<PipelineValue>{ in }, overrides, cache);
+}
+
+// Executes a compiled plan. Independent steps of a wave run concurrently and
+// each intermediate is dropped right after its last reader so its buffer can
+// be reused. Pass `keep` to retain every intermediate value instead, and
+// `cache` to reuse results of steps already run on the same content.
+inline PipelineValue runPipeline(const ExecutionPlan& plan, const PipelineValue& input,
+                                 std::map<std::string, PipelineValue>* keep = nullptr,
+                                 StageCache* cache = nullptr)
+{
+    std::map<std::string, PipelineValue> values;
+    std::map<std::string, uint64_t> keys;  // content address of each value
+    values["input"] = input;
+    if (cache) keys["input"] = hashPipelineValue(input);
+
+    auto stepKey = [&](const PlanStep& step) {
+        std::vector<uint64_t> inKeys;
+        for (const std::string& name : step.inputs) inKeys.push_back(keys.at(name));
+        uint64_t key = inputsKey(inKeys);
+        for (size_t k = 0; k < step.ops.size(); ++k)
+            key = stageKey(step.ops[k]->name, step.params[k], key);
+        return key;
+    };
+
+    for (size_t w = 0; w < plan.waves.size(); ++w) {
+        const std::vector<PlanStep>& wave = plan.waves[w];
+
+        // Look every step up first; only the misses run
+        std::vector<uint64_t> waveKeys(wave.size(), 0);
+        std::vector<bool> hit(wave.size(), false);
+        for (size_t s = 0; s < wave.size(); ++s) {
+            if (!cache) continue;
+            waveKeys[s] = stepKey(wave[s]);
+            keys[wave[s].output] = waveKeys[s];
+            PipelineValue cached;
+            if (cache->get(waveKeys[s], cached)) {
+                values[wave[s].output] = cached;
+                hit[s] = true;
+            }
+        }
+
+        std::vector<size_t> misses;
+        for (size_t s = 0; s < wave.size(); ++s)
+            if (!hit[s]) misses.push_back(s);
+
+        if (misses.size() == 1) {
+            const PlanStep& step = wave[misses[0]];
+            std::vector<PipelineValue> in;
+            // The caller still owns "input"; anything read again later is shared
+            bool reusable = !keep && step.inputs.size() == 1 && step.inputs[0] != "input"
+                            && plan.lastUse.at(step.inputs[0]) == static_cast<int>(w);
+            for (const std::string& name : step.inputs) in.push_back(values.at(name));
+            if (reusable) values.erase(step.inputs[0]);
+            values[step.output] = runStep(step, std::move(in), reusable);
+        } else if (misses.size() > 1) {
+            std::vector<std::future<PipelineValue>> futures;
+            for (size_t s : misses) {
+                std::vector<PipelineValue> in;
+                for (const std::string& name : wave[s].inputs) in.push_back(values.at(name));
+                futures.push_back(std::async(std::launch::async, runStep, std::cref(wave[s]), in, false));
+            }
+            for (size_t i = 0; i < misses.size(); ++i)
+                values[wave[misses[i]].output] = futures[i].get();
+        }
+
+        if (cache)
+            for (size_t s : misses) cache->put(waveKeys[s], values[wave[s].output]);
+
+        // Release intermediates nobody reads any more
+        if (!keep) {
+            for (auto it = values.begin(); it != values.end();) {
+                auto last = plan.lastUse.find(it->first);
+                bool spent = last != plan.lastUse.end() && last->second <= static_cast<int>(w);
+                if (spent && it->first != plan.output)
+                    it = values.erase(it);
+                else
+                    ++it;
+            }
+        }
+    }
+
+    if (keep) *keep = values;
+    return values.at(plan.output);
+}
+
+inline PipelineValue runRecipe(const Recipe& recipe, const cv::Mat& image, int traits = TRAIT_NONE)
+{
+    PipelineValue input;
+    input.image = image;
+    input.traits = traits;
+    return runPipeline(compilePipeline(recipe), input);
+}
+
+// ---------------------------------- //
+// ---------- ^EXECUTION^ ----------- //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// ------------- SESSION ------------ //
+// ---------------------------------- //
+
+// Keeps every intermediate of one recipe run on one input, so changing a
+// parameter only re-runs the stages downstream of it. Used for interactive
+// tuning, where the same image is segmented over and over with small edits.
+// Values of stages fused into a per-pixel pass are not kept separately; ask
+// for the id that ends the pass instead.
+class PipelineSession {
+public:
+    explicit PipelineSession(const Recipe& recipe) : spec(recipe)
+    {
+        plan = compilePipeline(spec);
+        for (const StageSpec& s : spec.stages)
+            for (const std::string& in : s.inputs) readers[in].push_back(s.id);
+    }
+
+    // A new input invalidates everything
+    void setInput(const PipelineValue& input)
+    {
+        values.clear();
+        values["input"] = input;
+    }
+
+    // Returns false (and invalidates nothing) when the value is unchanged
+    bool setParam(const std::string& stageId, const std::string& name, double value)
+    {
+        StageSpec& s = stageSpec(stageId);
+        const StageOp& op = findStageOp(s.op);
+        if (!op.defaults.count(name))
+            CV_Error(cv::Error::StsBadArg, "Stage '" + stageId + "' has no parameter '" + name + "'");
+
+        auto current = s.params.find(name);
+        double old = current != s.params.end() ? current->second : op.defaults.at(name);
+        if (old == value) return false;
+
+        s.params[name] = value;
+        // Params (and which stages fuse) are baked into the plan
+        plan = compilePipeline(spec);
+        invalidate(stageId);
+        return true;
+    }
+
+    double param(const std::string& stageId, const std::string& name) const
+    {
+        for (const StageSpec& s : spec.stages) {
+            if (s.id != stageId) continue;
+            auto it = s.params.find(name);
+            if (it != s.params.end()) return it->second;
+            return findStageOp(s.op).defaults.at(name);
+        }
+        CV_Error(cv::Error::StsBadArg, "Recipe has no stage '" + stageId + "'");
+    }
+
+    // Runs every step whose output is missing; returns the recipe output
+    const PipelineValue& run()
+    {
+        CV_Assert(values.count("input"));
+        executed = 0;
+
+        for (const std::vector<PlanStep>& wave : plan.waves) {
+            std::vector<const PlanStep*> stale;
+            for (const PlanStep& step : wave)
+                if (!values.count(step.output)) stale.push_back(&step);
+
+            auto inputsOf = [&](const PlanStep& step) {
+                std::vector<PipelineValue> in;
+                for (const std::string& name : step.inputs) in.push_back(values.at(name));
+                return in;
+            };
+
+            if (stale.size() == 1) {
+                values[stale[0]->output] = runStep(*stale[0], inputsOf(*stale[0]), false);
+            } else if (stale.size() > 1) {
+                std::vector<std::future<PipelineValue>> futures;
+                for (const PlanStep* step : stale)
+                    futures.push_back(std::async(std::launch::async, runStep, std::cref(*step), inputsOf(*step), false));
+                for (size_t i = 0; i < stale.size(); ++i)
+                    values[stale[i]->output] = futures[i].get();
+            }
+            executed += stale.size();
+        }
+        return values.at(plan.output);
+    }
+
+    bool has(const std::string& id) const { return values.count(id) > 0; }
+    const PipelineValue& value(const std::string& id) const { return values.at(id); }
+    const Recipe& recipe() const { return spec; }
+
+    // Steps executed by the last run(); 0 means everything was up to date
+    size_t executedSteps() const { return executed; }
+
+private:
+    StageSpec& stageSpec(const std::string& stageId)
+    {
+        for (StageSpec& s : spec.stages)
+            if (s.id == stageId) return s;
+        CV_Error(cv::Error::StsBadArg, "Recipe has no stage '" + stageId + "'");
+    }
+
+    // Drops the value of `stageId` and of everything that reads it, directly
+    // or indirectly. A fused step is keyed by its last id, so dropping any
+    // value along the chain drops the step's output too.
+    void invalidate(const std::string& stageId)
+    {
+        std::vector<std::string> todo = { stageId };
+        std::set<std::string> seen;
+        while (!todo.empty()) {
+            std::string id = todo.back();
+            todo.pop_back();
+            if (!seen.insert(id).second) continue;
+            values.erase(id);
+            auto it = readers.find(id);
+            if (it != readers.end())
+                todo.insert(todo.end(), it->second.begin(), it->second.end());
+        }
+    }
+
+    Recipe spec;
+    ExecutionPlan plan;
+    std::map<std::string, std::vector<std::string>> readers;  // value -> stages reading it
+    std::map<std::string, PipelineValue> values;
+    size_t executed = 0;
+};
+
+// Seed and object counts of a watershed recipe over many foreground
+// fractions, from the opening and distance transform of one run (stage ids
+// of the built-ins). Stages already up to date are not re-run.
+inline FractionSweep sweepSessionFractions(PipelineSession& session, const std::vector<double>& fractions)
+{
+    session.run();
+    if (!session.has("opening") || !session.has("distance"))
+        CV_Error(cv::Error::StsBadArg, "Recipe '" + session.recipe().name + "' has no opening and distance stages to sweep");
+    return sweepThresholdFractions(session.value("opening").image, session.value("distance").image, fractions);
+}
+
+// ---------------------------------- //
+// ----------- ^SESSION^ ------------ //
+// ---------------------------------- //
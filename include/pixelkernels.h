@@ -0,0 +1,188 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+
+// ---------------------------------- //
+// ---------- PIXEL KERNELS --------- //
+// ---------------------------------- //
+
+// Per-pixel loops written against raw row pointers instead of Mat::at<>(),
+// with the element type and channel count fixed at compile time. The inner
+// loops then have no per-pixel type checks and the compiler can vectorize
+// them.
+
+// Compile-time pixel layout handed to a dispatched kernel
+template <typename T, int Cn>
+struct PixelFormat {
+    typedef T value_type;
+    static constexpr int channels = Cn;
+};
+
+template <typename T, typename Fn>
+inline void dispatchChannels(int cn, Fn&& fn)
+{
+    switch (cn) {
+    case 1: fn(PixelFormat<T, 1>()); break;
+    case 2: fn(PixelFormat<T, 2>()); break;
+    case 3: fn(PixelFormat<T, 3>()); break;
+    case 4: fn(PixelFormat<T, 4>()); break;
+    default: CV_Error(cv::Error::StsUnsupportedFormat, "Unsupported channel count");
+    }
+}
+
+// Calls fn(PixelFormat<T, Cn>()) for the depth and channel count of `type`:
+//
+//   dispatchPixelFormat(m.type(), [&](auto fmt) {
+//       typedef typename decltype(fmt)::value_type T;
+//       ... m.ptr<T>(y) ...
+//   });
+template <typename Fn>
+inline void dispatchPixelFormat(int type, Fn&& fn)
+{
+    int cn = CV_MAT_CN(type);
+    switch (CV_MAT_DEPTH(type)) {
+    case CV_8U:  dispatchChannels<uchar>(cn, fn); break;
+    case CV_16U: dispatchChannels<ushort>(cn, fn); break;
+    case CV_16S: dispatchChannels<short>(cn, fn); break;
+    case CV_32S: dispatchChannels<int>(cn, fn); break;
+    case CV_32F: dispatchChannels<float>(cn, fn); break;
+    default: CV_Error(cv::Error::StsUnsupportedFormat, "Unsupported pixel depth");
+    }
+}
+
+// fn(y0, y1) over strips of rows, in parallel. Strips are at least
+// `minRows` tall so small images don't pay for thread hand-off.
+template <typename Fn>
+inline void parallelRows(int rows, Fn&& fn, int minRows = 16)
+{
+    int strips = std::max(1, std::min(rows / std::max(1, minRows), cv::getNumThreads() * 4));
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& r) { fn(r.start, r.end); }, strips);
+}
+
+// fn(const S* srcRow, D* dstRow, int width) for every row; width in pixels
+template <typename S, typename D, typename Fn>
+inline void mapRows(const cv::Mat& src, cv::Mat& dst, Fn&& fn)
+{
+    CV_Assert(src.size() == dst.size());
+    parallelRows(src.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y)
+            fn(src.ptr<S>(y), dst.ptr<D>(y), src.cols);
+    });
+}
+
+// ---------------------------------- //
+// --------- ^PIXEL KERNELS^ -------- //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// ---------- LABEL KERNELS --------- //
+// ---------------------------------- //
+
+// Marker convention (as produced by the watershed): -1 boundary, 0 unknown,
+// 1 background, 2.. objects. Markers may be any single-channel integer depth.
+
+inline int maxLabel(const cv::Mat& markers)
+{
+    double maxVal = 0.0;
+    cv::minMaxLoc(markers, nullptr, &maxVal);
+    return static_cast<int>(maxVal);
+}
+
+// Sorted object labels (> 1) present in `markers`
+inline std::vector<int> collectLabels(const cv::Mat& markers)
+{
+    CV_Assert(markers.channels() == 1);
+    std::vector<int> labels;
+    const int top = maxLabel(markers);
+    if (top < 2) return labels;
+
+    std::vector<uchar> present(top + 1, 0);
+    std::mutex merge;
+    dispatchPixelFormat(markers.type(), [&](auto fmt) {
+        typedef typename decltype(fmt)::value_type T;
+        parallelRows(markers.rows, [&](int y0, int y1) {
+            std::vector<uchar> seen(top + 1, 0);
+            for (int y = y0; y < y1; ++y) {
+                const T* m = markers.ptr<T>(y);
+                for (int x = 0; x < markers.cols; ++x) {
+                    int label = static_cast<int>(m[x]);
+                    seen[label > 1 ? label : 0] = 1;
+                }
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            for (int l = 2; l <= top; ++l) present[l] |= seen[l];
+        });
+    });
+
+    for (int l = 2; l <= top; ++l)
+        if (present[l]) labels.push_back(l);
+    return labels;
+}
+
+// dst = lut[label]; -1 gets `boundary`, labels outside the table stay Pixel()
+template <typename Pixel>
+inline void fillFromLabels(const cv::Mat& markers, cv::Mat& dst, const std::vector<Pixel>& lut, const Pixel& boundary)
+{
+    CV_Assert(markers.channels() == 1 && dst.size() == markers.size() && dst.elemSize() == sizeof(Pixel));
+    const int n = static_cast<int>(lut.size());
+    dispatchPixelFormat(markers.type(), [&](auto fmt) {
+        typedef typename decltype(fmt)::value_type T;
+        mapRows<T, Pixel>(markers, dst, [&](const T* m, Pixel* d, int width) {
+            for (int x = 0; x < width; ++x) {
+                int label = static_cast<int>(m[x]);
+                d[x] = (label >= 0 && label < n) ? lut[label] : (label == -1 ? boundary : Pixel());
+            }
+        });
+    });
+}
+
+// Area and coordinate sums per label, i.e. binary moments m00, m10, m01 of
+// every object in one pass instead of one full-frame mask per object
+struct LabelMoments {
+    double m00 = 0.0;
+    double m10 = 0.0;
+    double m01 = 0.0;
+};
+
+inline std::vector<LabelMoments> labelMoments(const cv::Mat& markers)
+{
+    CV_Assert(markers.channels() == 1);
+    const int top = std::max(1, maxLabel(markers));
+    std::vector<LabelMoments> total(top + 1);
+    std::mutex merge;
+    dispatchPixelFormat(markers.type(), [&](auto fmt) {
+        typedef typename decltype(fmt)::value_type T;
+        parallelRows(markers.rows, [&](int y0, int y1) {
+            std::vector<LabelMoments> local(top + 1);
+            for (int y = y0; y < y1; ++y) {
+                const T* m = markers.ptr<T>(y);
+                for (int x = 0; x < markers.cols; ++x) {
+                    int label = static_cast<int>(m[x]);
+                    if (label < 2) continue;
+                    LabelMoments& lm = local[label];
+                    lm.m00 += 1.0;
+                    lm.m10 += x;
+                    lm.m01 += y;
+                }
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            for (int l = 2; l <= top; ++l) {
+                total[l].m00 += local[l].m00;
+                total[l].m10 += local[l].m10;
+                total[l].m01 += local[l].m01;
+            }
+        });
+    });
+    return total;
+}
+
+// ---------------------------------- //
+// --------- ^LABEL KERNELS^ -------- //
+// ---------------------------------- //
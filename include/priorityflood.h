@@ -0,0 +1,171 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <vector>
+
+#include "matpool.h"
+#include "simdkernels.h"
+
+
+// ---------------------------------- //
+// --------- PRIORITY FLOOD --------- //
+// ---------------------------------- //
+
+// Meyer's flooding: unknown pixels are labelled in the order the water
+// reaches them on a landscape, so two regions meet on the ridge between
+// them instead of wherever two breadth-first fronts happen to collide.
+//
+// Priorities are 8- or 16-bit levels, so the priority queue is one FIFO per
+// level. Push and pop are O(1) and a whole flood is linear in the pixel
+// count. The flood level never drops: a pixel below the current level is
+// queued at the current level (its basin is already full up to there).
+// Within a level pixels leave in arrival order, so on a flat landscape the
+// flood is the same breadth-first growth as floodBFS.
+
+class BucketQueue {
+public:
+    // levels: priorities 0 .. levels - 1; items: pixel indices 0 .. items - 1
+    BucketQueue(int levels, int items)
+        : head(levels, -1), tail(levels, -1)
+    {
+        links = matPool().acquire(1, std::max(1, items), CV_32SC1);
+        next = links.ptr<int>(0);
+    }
+
+    void push(int level, int item)
+    {
+        level = std::max(level, current);
+        next[item] = -1;
+        if (tail[level] < 0) head[level] = item;
+        else next[tail[level]] = item;
+        tail[level] = item;
+    }
+
+    // False once every level is empty
+    bool pop(int& item)
+    {
+        const int levels = static_cast<int>(head.size());
+        while (current < levels && head[current] < 0) ++current;
+        if (current == levels) return false;
+        item = head[current];
+        head[current] = next[item];
+        if (head[current] < 0) tail[current] = -1;
+        return true;
+    }
+
+    int level() const { return current; }
+
+private:
+    std::vector<int> head, tail;  // first/last item per level, -1 = empty
+    cv::Mat links;                // pooled storage for `next`
+    int* next = nullptr;          // item after each item in its level
+    int current = 0;
+};
+
+namespace pflood {
+
+// Flood order from a landscape: higher values are reached first, so seeds
+// sitting on peaks (distance transform maxima, bright nuclei) grow downhill.
+// 8U/16U data is inverted as is; anything else is scaled onto 16 bits.
+// Multi-channel images are read through simd::firstPlane(). Returns the
+// number of levels.
+inline int floodLevels(const cv::Mat& landscape, cv::Mat& levels)
+{
+    cv::Mat plane = simd::firstPlane(landscape);
+
+    if (plane.depth() == CV_8U) {
+        levels = matPool().acquire(plane.size(), CV_8UC1);
+        plane.convertTo(levels, CV_8U, -1.0, 255.0);
+        return 256;
+    }
+
+    levels = matPool().acquire(plane.size(), CV_16UC1);
+    if (plane.depth() == CV_16U) {
+        plane.convertTo(levels, CV_16U, -1.0, 65535.0);
+    } else {
+        double lo = 0.0, hi = 0.0;
+        cv::minMaxLoc(plane, &lo, &hi);
+        double scale = hi > lo ? 65535.0 / (hi - lo) : 0.0;
+        plane.convertTo(levels, CV_16U, -scale, hi * scale);
+    }
+    return 65536;
+}
+
+template <typename T>
+void floodLevelsInto(const cv::Mat& levels, int levelCount, cv::Mat& markers)
+{
+    const int rows = markers.rows, cols = markers.cols;
+    const T* L = levels.ptr<T>(0);
+    int* m = markers.ptr<int>(0);
+    const int kQueued = -2;
+
+    // Unknown pixels touching a label start the flood at their own level
+    BucketQueue queue(levelCount, rows * cols);
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            const int i = y * cols + x;
+            if (m[i] != 0) continue;
+            if ((x > 0 && m[i - 1] > 0) || (x < cols - 1 && m[i + 1] > 0) ||
+                (y > 0 && m[i - cols] > 0) || (y < rows - 1 && m[i + cols] > 0)) {
+                m[i] = kQueued;
+                queue.push(L[i], i);
+            }
+        }
+    }
+
+    int i;
+    while (queue.pop(i)) {
+        const int x = i % cols, y = i / cols;
+        int neighbours[4];
+        int count = 0;
+        if (x > 0) neighbours[count++] = i - 1;
+        if (x < cols - 1) neighbours[count++] = i + 1;
+        if (y > 0) neighbours[count++] = i - cols;
+        if (y < rows - 1) neighbours[count++] = i + cols;
+
+        // Take the neighbouring region; two different regions make a -1
+        // boundary. Background (1) floods too but loses to any region and
+        // never forms a boundary, as in floodBFS.
+        int label = 0;
+        bool conflict = false;
+        for (int k = 0; k < count; ++k) {
+            const int v = m[neighbours[k]];
+            if (v <= 0) continue;
+            if (v == 1) { if (label == 0) label = 1; }
+            else if (label <= 1) label = v;
+            else if (label != v) conflict = true;
+        }
+        m[i] = conflict ? -1 : label;
+        if (conflict) continue;  // boundaries do not spread
+
+        for (int k = 0; k < count; ++k) {
+            const int j = neighbours[k];
+            if (m[j] != 0) continue;
+            m[j] = kQueued;
+            queue.push(L[j], j);
+        }
+    }
+}
+
+}  // namespace pflood
+
+// markers: CV_32SC1 as watershedSeedMarkers makes them (regions from 2,
+// 1 = background, 0 = unknown), flooded in place with -1 boundaries like
+// cv::watershed. landscape: same size, any depth (see pflood::floodLevels).
+inline void priorityFlood(const cv::Mat& landscape, cv::Mat& markers)
+{
+    CV_Assert(markers.type() == CV_32SC1 && landscape.size() == markers.size());
+    if (!markers.isContinuous()) markers = markers.clone();
+
+    cv::Mat levels;
+    const int levelCount = pflood::floodLevels(landscape, levels);
+    if (levels.depth() == CV_8U)
+        pflood::floodLevelsInto<uchar>(levels, levelCount, markers);
+    else
+        pflood::floodLevelsInto<ushort>(levels, levelCount, markers);
+}
+
+// ---------------------------------- //
+// -------- ^PRIORITY FLOOD^ -------- //
+// ---------------------------------- //
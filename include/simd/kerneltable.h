@@ -0,0 +1,35 @@
+#pragma once
+
+// Row kernels implemented once per instruction set. Each src/simd/*.cpp is
+// built with its own ISA flags and only sees this plain-C header, so no
+// inline OpenCV or STL code gets compiled with wider instructions than the
+// CPU running it supports. simdkernels.h picks a table at run time.
+
+#include <cstdint>
+
+namespace simd {
+
+struct KernelTable {
+    const char* isa;
+
+    // dst[x] = src[x * cn + channel]; cn is 3 or 4
+    void (*extractChannel8u)(const uint8_t* src, uint8_t* dst, int width, int cn, int channel);
+    void (*extractChannel16u)(const uint16_t* src, uint16_t* dst, int width, int cn, int channel);
+
+    // BGR(A) to gray with cvtColor's 14-bit fixed-point weights and rounding
+    void (*bgrToGray8u)(const uint8_t* src, uint8_t* dst, int width, int cn);
+
+    // dst[x] = src[x] > level ? 255 : 0
+    void (*threshold8u)(const uint8_t* src, uint8_t* dst, int width, uint8_t level);
+
+    // Bit x % 64 of dst[x / 64] = src[x] > level; trailing bits of the last
+    // word are cleared
+    void (*thresholdBits8u)(const uint8_t* src, uint64_t* dst, int width, uint8_t level);
+};
+
+// nullptr when the translation unit was built without that instruction set
+const KernelTable* sse42KernelTable();
+const KernelTable* avx2KernelTable();
+const KernelTable* avx512KernelTable();
+
+}  // namespace simd
@@ -0,0 +1,48 @@
+#pragma once
+
+// Portable versions of the KernelTable row kernels. Used as the fallback
+// table and for the leftover pixels at the end of each vectorized row.
+// Everything here is `static` on purpose: every translation unit gets its
+// own copy compiled with its own flags, so the linker can never hand an
+// AVX-512 build of these to a machine without it.
+
+#include <cstdint>
+#include <cstring>
+
+namespace simd {
+namespace scalar {
+
+static inline void extractChannel8u(const uint8_t* src, uint8_t* dst, int width, int cn, int channel)
+{
+    for (int x = 0; x < width; ++x) dst[x] = src[x * cn + channel];
+}
+
+static inline void extractChannel16u(const uint16_t* src, uint16_t* dst, int width, int cn, int channel)
+{
+    for (int x = 0; x < width; ++x) dst[x] = src[x * cn + channel];
+}
+
+static inline void bgrToGray8u(const uint8_t* src, uint8_t* dst, int width, int cn)
+{
+    for (int x = 0; x < width; ++x, src += cn)
+        dst[x] = static_cast<uint8_t>((src[0] * 1868 + src[1] * 9617 + src[2] * 4899 + (1 << 13)) >> 14);
+}
+
+static inline void threshold8u(const uint8_t* src, uint8_t* dst, int width, uint8_t level)
+{
+    for (int x = 0; x < width; ++x) dst[x] = src[x] > level ? 255 : 0;
+}
+
+// Starts at pixel `from`, which must be a multiple of 64
+static inline void thresholdBits8u(const uint8_t* src, uint64_t* dst, int width, uint8_t level, int from = 0)
+{
+    for (int x = from; x < width; x += 64) {
+        uint64_t word = 0;
+        int n = width - x < 64 ? width - x : 64;
+        for (int b = 0; b < n; ++b) word |= static_cast<uint64_t>(src[x + b] > level) << b;
+        dst[x / 64] = word;
+    }
+}
+
+}  // namespace scalar
+}  // namespace simd
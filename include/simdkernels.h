@@ -0,0 +1,164 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#include "matpool.h"
+#include "pixelkernels.h"
+#include "simd/kerneltable.h"
+#include "simd/scalarrows.h"
+
+
+// ---------------------------------- //
+// ---------- SIMD DISPATCH --------- //
+// ---------------------------------- //
+
+namespace simd {
+
+inline const KernelTable& scalarKernelTable()
+{
+    static const KernelTable table = {
+        "scalar",
+        [](const uint8_t* s, uint8_t* d, int w, int cn, int c) { scalar::extractChannel8u(s, d, w, cn, c); },
+        [](const uint16_t* s, uint16_t* d, int w, int cn, int c) { scalar::extractChannel16u(s, d, w, cn, c); },
+        [](const uint8_t* s, uint8_t* d, int w, int cn) { scalar::bgrToGray8u(s, d, w, cn); },
+        [](const uint8_t* s, uint8_t* d, int w, uint8_t l) { scalar::threshold8u(s, d, w, l); },
+        [](const uint8_t* s, uint64_t* d, int w, uint8_t l) { scalar::thresholdBits8u(s, d, w, l); },
+    };
+    return table;
+}
+
+// Widest table this CPU supports. The ISA kernels are linked in when CMake
+// builds src/simd (CYTO_SIMD_KERNELS); set CYTO_SIMD=scalar|sse42|avx2 to
+// cap the choice, e.g. to compare them in the perf gate.
+inline const KernelTable& kernels()
+{
+    static const KernelTable* chosen = [] {
+        const KernelTable* best = &scalarKernelTable();
+#ifdef CYTO_SIMD_KERNELS
+        const char* env = std::getenv("CYTO_SIMD");
+        std::string cap = env ? env : "avx512";
+        if (cap == "scalar") return best;
+
+        if (cv::checkHardwareSupport(CV_CPU_SSE4_2) && sse42KernelTable())
+            best = sse42KernelTable();
+        if (cap == "sse42") return best;
+        if (cv::checkHardwareSupport(CV_CPU_AVX2) && avx2KernelTable())
+            best = avx2KernelTable();
+        if (cap == "avx2") return best;
+        if (cv::checkHardwareSupport(CV_CPU_AVX_512BW) && avx512KernelTable())
+            best = avx512KernelTable();
+#endif
+        return best;
+    }();
+    return *chosen;
+}
+
+// ---------------------------------- //
+// --------- ^SIMD DISPATCH^ -------- //
+// ---------------------------------- //
+
+
+
+
+// ---------------------------------- //
+// ----------- MAT KERNELS ---------- //
+// ---------------------------------- //
+
+// One channel of an interleaved 8U/16U BGR(A) image. Other layouts go
+// through cv::extractChannel.
+inline void extractChannel(const cv::Mat& src, cv::Mat& dst, int channel)
+{
+    const int cn = src.channels();
+    if ((cn != 3 && cn != 4) || (src.depth() != CV_8U && src.depth() != CV_16U)) {
+        cv::extractChannel(src, dst, channel);
+        return;
+    }
+
+    dst.create(src.size(), CV_MAKETYPE(src.depth(), 1));
+    const KernelTable& k = kernels();
+    if (src.depth() == CV_8U) {
+        mapRows<uchar, uchar>(src, dst, [&](const uchar* s, uchar* d, int width) {
+            k.extractChannel8u(s, d, width, cn, channel);
+        });
+    } else {
+        mapRows<ushort, ushort>(src, dst, [&](const ushort* s, ushort* d, int width) {
+            k.extractChannel16u(s, d, width, cn, channel);
+        });
+    }
+}
+
+// The plane a grey or binary image is processed on: channel 0 (pooled), or
+// the image itself if it has one channel. The pipeline's grey and binary
+// images carry the same value in B, G and R, so channel 0 stands for all.
+inline cv::Mat firstPlane(const cv::Mat& src)
+{
+    if (src.channels() == 1) return src;
+    cv::Mat plane = matPool().acquire(src.size(), src.depth());
+    simd::extractChannel(src, plane, 0);
+    return plane;
+}
+
+// Same result as cvtColor(BGR2GRAY / BGRA2GRAY) for 8-bit data
+inline void bgrToGray(const cv::Mat& src, cv::Mat& dst)
+{
+    const int cn = src.channels();
+    if (src.depth() != CV_8U || (cn != 3 && cn != 4)) {
+        cv::cvtColor(src, dst, cn == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+        return;
+    }
+
+    dst.create(src.size(), CV_8UC1);
+    const KernelTable& k = kernels();
+    mapRows<uchar, uchar>(src, dst, [&](const uchar* s, uchar* d, int width) {
+        k.bgrToGray8u(s, d, width, cn);
+    });
+}
+
+// Same result as threshold(THRESH_BINARY, 255) for 8-bit single channel
+inline void thresholdBinary(const cv::Mat& gray, cv::Mat& dst, double level)
+{
+    CV_Assert(gray.type() == CV_8UC1);
+    dst.create(gray.size(), CV_8UC1);
+    if (level < 0 || level >= 255) {
+        dst.setTo(cv::Scalar::all(level < 0 ? 255 : 0));
+        return;
+    }
+
+    const uint8_t l = static_cast<uint8_t>(std::floor(level));
+    const KernelTable& k = kernels();
+    mapRows<uchar, uchar>(gray, dst, [&](const uchar* s, uchar* d, int width) {
+        k.threshold8u(s, d, width, l);
+    });
+}
+
+// Bit-packed threshold: row y goes to words + y * wordsPerRow, one bit per
+// pixel (bit x % 64 of word x / 64)
+inline void thresholdBits(const cv::Mat& gray, uint64_t* words, size_t wordsPerRow, double level)
+{
+    CV_Assert(gray.type() == CV_8UC1 && wordsPerRow * 64 >= static_cast<size_t>(gray.cols));
+    const uint8_t l = static_cast<uint8_t>(std::min(255.0, std::max(0.0, std::floor(level))));
+    const bool allSet = level < 0;
+    const KernelTable& k = kernels();
+    parallelRows(gray.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            uint64_t* row = words + y * wordsPerRow;
+            std::fill(row, row + wordsPerRow, 0);
+            if (allSet) {
+                for (int x = 0; x < gray.cols; ++x) row[x / 64] |= uint64_t(1) << (x % 64);
+            } else {
+                k.thresholdBits8u(gray.ptr<uchar>(y), row, gray.cols, l);
+            }
+        }
+    });
+}
+
+}  // namespace simd
+
+// ---------------------------------- //
+// ---------- ^MAT KERNELS^ --------- //
+// ---------------------------------- //
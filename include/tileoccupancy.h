@@ -0,0 +1,158 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <vector>
+
+#include "pixelkernels.h"
+
+
+// ---------------------------------- //
+// --------- TILE OCCUPANCY --------- //
+// ---------------------------------- //
+
+// Which 64x64 tiles of a mask hold any foreground. Most fields are largely
+// background, and after thresholding nothing in an empty tile can change:
+// the distance transform, area opening and closing all give 0 there. The
+// occupied tiles are grouped into a few rectangles that are processed on
+// their own, and the rest of the output is just zero-filled.
+//
+// regions(margin) pads every occupied tile by `margin` pixels, groups what
+// touches and merges rectangles that overlap, so every rectangle is framed
+// by at least `margin` pixels of background (or the image edge). An
+// operation that looks no further than `margin` pixels, or that follows
+// connected components (labeling, area opening, distance to background),
+// then gives the same result inside a rectangle as on the whole frame.
+class TileOccupancy {
+public:
+    static const int kTile = 64;
+
+    TileOccupancy() {}
+
+    // mask: any depth, any channel count; nonzero = foreground
+    explicit TileOccupancy(const cv::Mat& mask)
+        : frame(mask.size()),
+          tilesX((mask.cols + kTile - 1) / kTile), tilesY((mask.rows + kTile - 1) / kTile),
+          occupied(static_cast<size_t>(tilesX) * tilesY, 0)
+    {
+        const int cn = mask.channels();
+        dispatchPixelFormat(CV_MAKETYPE(mask.depth(), 1), [&](auto fmt) {
+            typedef typename decltype(fmt)::value_type T;
+            parallelRows(tilesY, [&](int t0, int t1) {
+                for (int ty = t0; ty < t1; ++ty) {
+                    uchar* tiles = &occupied[static_cast<size_t>(ty) * tilesX];
+                    const int yEnd = std::min(mask.rows, (ty + 1) * kTile);
+                    for (int y = ty * kTile; y < yEnd; ++y) {
+                        const T* row = mask.ptr<T>(y);
+                        for (int tx = 0; tx < tilesX; ++tx) {
+                            if (tiles[tx]) continue;
+                            const int begin = tx * kTile * cn, end = std::min(mask.cols, (tx + 1) * kTile) * cn;
+                            // OR-reduce without an early exit so the loop vectorizes
+                            bool any = false;
+                            for (int i = begin; i < end; ++i) any |= row[i] != 0;
+                            tiles[tx] = any;
+                        }
+                    }
+                }
+            }, 1);
+        });
+    }
+
+    cv::Size size() const { return frame; }
+    bool occupiedTile(int tx, int ty) const { return occupied[static_cast<size_t>(ty) * tilesX + tx] != 0; }
+
+    // Fraction of tiles holding foreground
+    double fill() const
+    {
+        if (occupied.empty()) return 0.0;
+        return std::count(occupied.begin(), occupied.end(), 1) / static_cast<double>(occupied.size());
+    }
+
+    std::vector<cv::Rect> regions(int margin) const
+    {
+        // Occupied tiles grown by the margin (in tiles), grouped 8-connected
+        const int r = (std::max(0, margin) + kTile - 1) / kTile;
+        std::vector<uchar> grown(occupied.size(), 0);
+        for (int ty = 0; ty < tilesY; ++ty)
+            for (int tx = 0; tx < tilesX; ++tx) {
+                if (!occupiedTile(tx, ty)) continue;
+                for (int y = std::max(0, ty - r); y <= std::min(tilesY - 1, ty + r); ++y)
+                    for (int x = std::max(0, tx - r); x <= std::min(tilesX - 1, tx + r); ++x)
+                        grown[static_cast<size_t>(y) * tilesX + x] = 1;
+            }
+
+        std::vector<cv::Rect> rects;
+        std::vector<int> stack;
+        for (int start = 0; start < static_cast<int>(grown.size()); ++start) {
+            if (!grown[start]) continue;
+            int x0 = tilesX, y0 = tilesY, x1 = -1, y1 = -1;
+            grown[start] = 0;
+            stack.push_back(start);
+            while (!stack.empty()) {
+                const int t = stack.back(), tx = t % tilesX, ty = t / tilesX;
+                stack.pop_back();
+                x0 = std::min(x0, tx); x1 = std::max(x1, tx);
+                y0 = std::min(y0, ty); y1 = std::max(y1, ty);
+                for (int y = std::max(0, ty - 1); y <= std::min(tilesY - 1, ty + 1); ++y)
+                    for (int x = std::max(0, tx - 1); x <= std::min(tilesX - 1, tx + 1); ++x) {
+                        const int n = y * tilesX + x;
+                        if (grown[n]) { grown[n] = 0; stack.push_back(n); }
+                    }
+            }
+            rects.push_back(cv::Rect(x0 * kTile, y0 * kTile, (x1 - x0 + 1) * kTile, (y1 - y0 + 1) * kTile) &
+                            cv::Rect(0, 0, frame.width, frame.height));
+        }
+
+        // Bounding boxes of separate groups can still overlap; merge them
+        for (bool merged = true; merged;) {
+            merged = false;
+            for (size_t i = 0; i < rects.size() && !merged; ++i)
+                for (size_t j = i + 1; j < rects.size(); ++j) {
+                    if ((rects[i] & rects[j]).area() == 0) continue;
+                    rects[i] |= rects[j];
+                    rects.erase(rects.begin() + j);
+                    merged = true;
+                    break;
+                }
+        }
+        return rects;
+    }
+
+private:
+    cv::Size frame;
+    int tilesX = 0, tilesY = 0;
+    std::vector<uchar> occupied;
+};
+
+// Above this share of the frame the regions are processed as one image:
+// splitting only adds overhead
+const double kSparseCoverageLimit = 0.6;
+
+// fn(srcRegion, dstRegion) on every region of `occupancy` (see above), with
+// the rest of dst zero-filled; fn must write into dstRegion in place. Dense
+// masks get a single call on the whole frame. dst must already have its
+// size and type.
+template <typename Fn>
+void forEachOccupiedRegion(const TileOccupancy& occupancy, int margin, const cv::Mat& src, cv::Mat& dst, Fn&& fn)
+{
+    CV_Assert(src.size() == occupancy.size() && dst.size() == src.size());
+    const std::vector<cv::Rect> rects = occupancy.regions(margin);
+    double covered = 0.0;
+    for (const cv::Rect& r : rects) covered += r.area();
+    if (covered > kSparseCoverageLimit * src.total()) {
+        fn(src, dst);
+        return;
+    }
+
+    dst.setTo(cv::Scalar::all(0));
+    cv::parallel_for_(cv::Range(0, static_cast<int>(rects.size())), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            cv::Mat out = dst(rects[i]);
+            fn(src(rects[i]), out);
+        }
+    });
+}
+
+// ---------------------------------- //
+// -------- ^TILE OCCUPANCY^ -------- //
+// ---------------------------------- //
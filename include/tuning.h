@@ -0,0 +1,207 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <memory>
+
+#include "pipeline.h"
+
+
+// ---------------------------------- //
+// ------- SEGMENTATION TUNING ------ //
+// ---------------------------------- //
+
+// What the tuning sliders edit. Expressed at full resolution; the proxy run
+// scales the size-dependent ones down.
+struct TuningParams {
+    int backgroundMethod = BACKGROUND_NONE;
+    int backgroundRadius = 50;
+    float sigma = 3.0f;
+    bool recursiveBlur = false;   // constant-time blur for large sigmas
+    bool otsu = true;
+    int threshold = 128;          // used when otsu is off
+    int localMethod = LOCAL_THRESH_NONE;  // replaces otsu/threshold when set
+    int localWindow = 51;
+    float localK = 0.2f;
+    float localOffset = 0.0f;
+    int openIterations = 2;
+    int dilateIterations = 0;
+    float thresholdFraction = 0.1f;
+    int closingKernel = 7;
+    int minObjectArea = 0;        // area opening before the 3x3 opening, pixels
+};
+
+// Reads the current values from a watershed recipe session. The tuned
+// recipes must use the stage ids of the built-ins (background, blur,
+// binary, opening, sure_bg, sure_fg).
+inline TuningParams readTuningParams(const PipelineSession& session)
+{
+    TuningParams p;
+    p.backgroundMethod = static_cast<int>(session.param("background", "method"));
+    p.backgroundRadius = static_cast<int>(session.param("background", "radius"));
+    p.sigma = static_cast<float>(session.param("blur", "sigma"));
+    p.recursiveBlur = session.param("blur", "mode") == BLUR_RECURSIVE;
+    double level = session.param("binary", "threshold");
+    p.otsu = level < 0;
+    if (!p.otsu) p.threshold = static_cast<int>(level);
+    p.localMethod = static_cast<int>(session.param("binary", "method"));
+    p.localWindow = static_cast<int>(session.param("binary", "window"));
+    p.localK = static_cast<float>(session.param("binary", "k"));
+    p.localOffset = static_cast<float>(session.param("binary", "offset"));
+    p.openIterations = static_cast<int>(session.param("opening", "iterations"));
+    p.dilateIterations = static_cast<int>(session.param("sure_bg", "iterations"));
+    p.thresholdFraction = static_cast<float>(session.param("sure_fg", "threshold_fraction"));
+    p.closingKernel = static_cast<int>(session.param("sure_fg", "closing_kernel"));
+    p.minObjectArea = static_cast<int>(session.param("opening", "min_area"));
+    return p;
+}
+
+// Returns true if any parameter actually changed
+inline bool applyTuningParams(PipelineSession& session, const TuningParams& p, double scale)
+{
+    bool changed = false;
+    changed |= session.setParam("background", "method", p.backgroundMethod);
+    changed |= session.setParam("background", "radius", std::max(1L, std::lround(p.backgroundRadius * scale)));
+    changed |= session.setParam("blur", "sigma", std::max(0.3, p.sigma * scale));
+    changed |= session.setParam("blur", "mode", p.recursiveBlur ? BLUR_RECURSIVE : BLUR_GAUSSIAN);
+    changed |= session.setParam("binary", "threshold", p.otsu ? -1.0 : static_cast<double>(p.threshold));
+    changed |= session.setParam("binary", "method", p.localMethod);
+    changed |= session.setParam("binary", "window", scaledKernel(p.localWindow, scale));
+    changed |= session.setParam("binary", "k", p.localK);
+    changed |= session.setParam("binary", "offset", p.localOffset);
+    changed |= session.setParam("opening", "iterations", scaledIterations(p.openIterations, scale));
+    changed |= session.setParam("opening", "min_area", std::lround(p.minObjectArea * scale * scale));
+    changed |= session.setParam("sure_bg", "iterations", scaledIterations(p.dilateIterations, scale));
+    changed |= session.setParam("sure_fg", "threshold_fraction", p.thresholdFraction);
+    changed |= session.setParam("sure_fg", "closing_kernel", scale == 1.0 ? p.closingKernel : scaledKernel(p.closingKernel, scale));
+    return changed;
+}
+
+// Runs a recipe on a downscaled copy of the image for immediate feedback
+// while sliders move, and on the full image in the background once they
+// settle. Both sides keep a PipelineSession, so an edit only re-runs the
+// stages after the changed parameter. The full-resolution session belongs
+// to the background task while one is running.
+class ProxyTuner {
+public:
+    explicit ProxyTuner(const Recipe& recipe) { setRecipe(recipe); }
+
+    void setRecipe(const Recipe& recipe)
+    {
+        waitForRefine();
+        proxySession = std::make_unique<PipelineSession>(recipe);
+        fullSession = std::make_unique<PipelineSession>(recipe);
+        if (!proxyImage.empty()) setInputs();
+    }
+
+    // Proxy is 1/4 or 1/8 scale so that it stays around 1k pixels across;
+    // small images are previewed as they are
+    void setSource(const cv::Mat& image)
+    {
+        waitForRefine();
+        fullImage = image;
+        scale = 1.0;
+        while (std::max(image.rows, image.cols) * scale > 1024 && scale > 0.125) scale *= 0.5;
+        if (scale < 1.0)
+            cv::resize(image, proxyImage, cv::Size(), scale, scale, cv::INTER_AREA);
+        else
+            proxyImage = image;
+        setInputs();
+    }
+
+    TuningParams params() const { return readTuningParams(*fullSession); }
+    double proxyScale() const { return scale; }
+    double lastPreviewMs() const { return previewMs; }
+    int lastPreviewObjects() const { return previewObjects; }  // after closing and splitting
+
+    const PipelineValue& preview(const TuningParams& p)
+    {
+        auto start = std::chrono::steady_clock::now();
+        applyTuningParams(*proxySession, p, scale);
+        const PipelineValue& result = proxySession->run();
+        previewMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        previewObjects = result.segmentation.count;
+        return result;
+    }
+
+    // Seed/object counts over `fractions` at proxy scale. After preview(p)
+    // this only costs the sweep itself.
+    FractionSweep sweep(const TuningParams& p, const std::vector<double>& fractions)
+    {
+        applyTuningParams(*proxySession, p, scale);
+        return sweepSessionFractions(*proxySession, fractions);
+    }
+
+    // Starts (or queues, if one is running) a full-resolution run
+    void refine(const TuningParams& p)
+    {
+        pendingParams = p;
+        pending = true;
+        if (!refining()) launchRefine();
+    }
+
+    bool refining() const { return refineTask.valid(); }
+
+    // Non-blocking; call once per frame. Hands back the full-resolution
+    // result only when it matches the latest requested parameters.
+    bool poll(PipelineValue& out)
+    {
+        if (!refining() || refineTask.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+
+        PipelineValue result = refineTask.get();
+        if (pending) {
+            launchRefine();
+            return false;
+        }
+        out = result;
+        return true;
+    }
+
+private:
+    void setInputs()
+    {
+        PipelineValue input;
+        input.image = proxyImage;
+        proxySession->setInput(input);
+        input.image = fullImage;
+        fullSession->setInput(input);
+    }
+
+    void launchRefine()
+    {
+        pending = false;
+        TuningParams p = pendingParams;
+        PipelineSession* session = fullSession.get();
+        refineTask = std::async(std::launch::async, [session, p]() {
+            applyTuningParams(*session, p, 1.0);
+            return session->run();
+        });
+    }
+
+    void waitForRefine()
+    {
+        if (refining()) refineTask.get();
+        pending = false;
+    }
+
+    std::unique_ptr<PipelineSession> proxySession;
+    std::unique_ptr<PipelineSession> fullSession;
+    cv::Mat fullImage;
+    cv::Mat proxyImage;
+    double scale = 1.0;
+    double previewMs = 0.0;
+    int previewObjects = 0;
+
+    std::future<PipelineValue> refineTask;
+    TuningParams pendingParams;
+    bool pending = false;
+};
+
+// ---------------------------------- //
+// ------ ^SEGMENTATION TUNING^ ----- //
+// ---------------------------------- //
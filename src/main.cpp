@@ -13,6 +13,9 @@
 
 #include "tinyfiledialogs.h"
 #include "functiondec.h"
+#include "imagehandle.h"
+#include "pipeline.h"
+#include "tuning.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -29,11 +32,11 @@
 
 static bool showImageViewer = false;
 std::string imageFilename;
-cv::Mat originalImage, currentImage, previousImage, nextImage;
+ImageHandle originalImage, currentImage;
 
-// Ctrl+Z/+Shift+Z
-std::stack<cv::Mat> undoStack;
-std::stack<cv::Mat> redoStack;
+// Ctrl+Z/+Shift+Z; entries share pixels with the current image
+std::stack<HistoryEntry> undoStack;
+std::stack<HistoryEntry> redoStack;
 
 // --------------------------- //
 // ---- ^Global Variables^ --- //
@@ -137,18 +140,202 @@ int main()
     // Other bools
     bool showDataTable = false;
     bool showNSITable = false;
+    bool showTuningWindow = false;
 
     // Image analysis
     std::vector<double> nsis;
     WatershedOutput watershedOut;
+    SegmentationHandle storedSegmentation;  // watershedOut as history entries keep it
     double avgNSI = 0.0;
     int objectCount = 0;
     
-    // Edit bools
-    bool singleChannel = false;
-    bool isGrayscale = false;
-    bool isBinary = false;
-    bool cellsSegmented = false;
+    // What has been applied to currentImage (see ImageTrait)
+    int imageTraits = TRAIT_NONE;
+
+    // Registered flat-field reference (0 = none loaded)
+    int64_t flatFieldId = 0;
+
+    // Pipelines behind Ctrl+1 / Ctrl+2 / Ctrl+3 and their menu items
+    const ExecutionPlan openCVPlan = compilePipeline(builtinRecipe("opencv_watershed"));
+    const ExecutionPlan customPlan = compilePipeline(builtinRecipe("custom_watershed"));
+    const ExecutionPlan priorityPlan = compilePipeline(builtinRecipe("priority_watershed"));
+    const ExecutionPlan coarsePlan = compilePipeline(builtinRecipe("coarse_watershed"));
+
+    // Segmentation tuning: proxy preview while dragging, full-res once released
+    ProxyTuner tuner(builtinRecipe("custom_watershed"));
+    TuningParams tuning;
+    int tuningEngine = 1;  // 0 = OpenCV, 1 = Custom, 2 = Priority
+    const char* const engineRecipes[] = { "opencv_watershed", "custom_watershed", "priority_watershed" };
+    PipelineValue tunedResult;
+    bool tunedReady = false;
+    bool showSweep = false;     // seed count vs foreground fraction, at proxy scale
+    FractionSweep fractionSweep;
+
+    auto currentValue = [&]() {
+        PipelineValue value;
+        value.image = currentImage.view();
+        value.traits = imageTraits;
+        value.segmentation = watershedOut;
+        value.measurements = nsis;
+        return value;
+    };
+
+    auto snapshot = [&]() {
+        return HistoryEntry{ currentImage, imageTraits, storedSegmentation, nsis };
+    };
+
+    auto restore = [&](const HistoryEntry& entry) {
+        currentImage = entry.image;
+        imageTraits = entry.traits;
+        storedSegmentation = entry.segmentation;
+        watershedOut = storedSegmentation.expand();
+        objectCount = watershedOut.count;
+        nsis = entry.nsis;
+        UpdateTextureFromMat(currentImage.view(), imageTexture, imageWidth, imageHeight);
+    };
+
+    // Records history and displays a stage or pipeline result
+    auto showResult = [&](const PipelineValue& result) {
+        undoStack.push(snapshot());
+        while (!redoStack.empty()) redoStack.pop();
+        currentImage = ImageHandle(displayImage(result));
+        imageTraits = result.traits;
+        UpdateTextureFromMat(currentImage.view(), imageTexture, imageWidth, imageHeight);
+    };
+
+    auto undo = [&]() {
+        if (undoStack.empty()) return;
+        redoStack.push(snapshot());
+        HistoryEntry entry = undoStack.top();
+        undoStack.pop();
+        restore(entry);
+    };
+
+    auto redo = [&]() {
+        if (redoStack.empty()) return;
+        undoStack.push(snapshot());
+        HistoryEntry entry = redoStack.top();
+        redoStack.pop();
+        restore(entry);
+    };
+
+    auto saveCurrent = [&]() {
+        HWND hwnd = glfwGetWin32Window(window);
+        std::string path = ShowSaveFileDialog(hwnd);
+
+        if (!path.empty() && !currentImage.empty()) {
+            bool success = cv::imwrite(path, currentImage.view());
+            if (!success) {
+                std::cerr << "Failed to save image to " << path << "\n";
+            }
+        }
+    };
+
+    auto showSegmentation = [&](const PipelineValue& result) {
+        showResult(result);
+        watershedOut = result.segmentation;
+        storedSegmentation = SegmentationHandle(watershedOut);
+        objectCount = watershedOut.count;
+        showObjectCntPopup = true;
+    };
+
+    // Single stage on the current image, or the prerequisite popup
+    auto applyToCurrent = [&](const std::string& op) {
+        if (!stageAccepts(op, imageTraits)) {
+            showPrereqPopup = true;
+            return;
+        }
+        PipelineValue result = applyStage(op, currentValue(), StageParams(), &stageCache());
+        if (result.traits & TRAIT_SEGMENTED)
+            showSegmentation(result);
+        else
+            showResult(result);
+    };
+
+    auto isolateChannel = [&]() {
+        PipelineValue original;
+        original.image = originalImage.view();
+        showResult(applyStage("isolate_channel", original, StageParams(), &stageCache()));
+    };
+
+    // Flat frame, then an optional dark frame (cancel to skip)
+    auto loadFlatField = [&]() {
+        const char* patterns[] = { "*.png", "*.jpg", "*.jpeg", "*.bmp", "*.tif", "*.tiff" };
+        const char* flatFile = tinyfd_openFileDialog("Open Flat-Field Reference", "", 6, patterns, "Image files", 0);
+        if (!flatFile) return;
+        cv::Mat flat = cv::imread(flatFile, cv::IMREAD_COLOR);
+        if (flat.empty()) {
+            std::cerr << "Failed to load flat-field reference." << std::endl;
+            return;
+        }
+
+        cv::Mat dark;
+        const char* darkFile = tinyfd_openFileDialog("Open Dark Frame (Cancel for none)", "", 6, patterns, "Image files", 0);
+        if (darkFile) {
+            dark = cv::imread(darkFile, cv::IMREAD_COLOR);
+            if (dark.empty()) std::cerr << "Failed to load dark frame; correcting without it." << std::endl;
+        }
+
+        try {
+            flatFieldId = registerFlatField(FlatField(flat, dark));
+        }
+        catch (const cv::Exception& e) {
+            std::cerr << "[Error] Flat-field reference: " << e.what() << std::endl;
+        }
+    };
+
+    auto correctFlatField = [&]() {
+        if (flatFieldId == 0) {
+            std::cerr << "No flat-field reference loaded (File > Load Flat-Field Reference)." << std::endl;
+            return;
+        }
+        StageParams params = { { "reference", static_cast<double>(flatFieldId) } };
+        try {
+            showResult(applyStage("flat_field", currentValue(), params, &stageCache()));
+        }
+        catch (const cv::Exception& e) {
+            std::cerr << "[Error] Flat-field correction: " << e.what() << std::endl;
+        }
+    };
+
+    // NSI needs segmented markers; returns an empty list otherwise
+    auto computeNSI = [&](bool display) {
+        nsis.clear();
+        if (!stageAccepts("nsi", imageTraits)) return;
+        PipelineValue labeled = applyStage("nsi", currentValue(), StageParams(), &stageCache());
+        nsis = labeled.measurements;
+        if (display) showResult(labeled);
+    };
+
+    auto showHeatmap = [&]() {
+        if (!stageAccepts("nsi_heatmap", imageTraits)) return;
+        PipelineValue current = currentValue();
+        PipelineValue heatmap = applyStage("nsi_heatmap", { current, current }, StageParams(), &stageCache());
+        showResult(heatmap);
+
+        // Scale of the heatmap; kept out of the stage so headless runs stay quiet
+        const std::vector<double>& shown = heatmap.measurements;
+        if (!shown.empty()) {
+            std::cout << "Minimum NSI: " << *std::min_element(shown.begin(), shown.end())
+                      << " (blue color: BGR = 255, 0, 0)\n";
+            std::cout << "Maximum NSI: " << *std::max_element(shown.begin(), shown.end())
+                      << " (red color: BGR = 0, 0, 255)\n";
+        }
+    };
+
+    // Starts tuning on the loaded image with the engine's recipe defaults
+    auto openTuning = [&]() {
+        if (originalImage.empty()) return;
+        tuner.setRecipe(builtinRecipe(engineRecipes[tuningEngine]));
+        tuner.setSource(originalImage.view());
+        tuning = tuner.params();
+        tunedReady = false;
+        fractionSweep = FractionSweep();
+        int w = 0, h = 0;  // keep the viewer at full-image size
+        UpdateTextureFromMat(displayImage(tuner.preview(tuning)), imageTexture, w, h);
+        tuner.refine(tuning);
+        showTuningWindow = true;
+    };
 
     // --------------------------- //
     // -- ^Pre-Loop Variables^ --- //
@@ -186,169 +373,75 @@ int main()
         // ============ Ctrl+S =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-            HWND hwnd = glfwGetWin32Window(window); 
-            std::string path = ShowSaveFileDialog(hwnd);
-
-            if (!path.empty() && !currentImage.empty()) {
-                cv::Mat currentImageSave = currentImage.clone();
-                cv::cvtColor(currentImageSave, currentImageSave, cv::COLOR_RGB2BGR);
-                bool success = cv::imwrite(path, currentImageSave);
-                if (!success) {
-                    std::cerr << "Failed to save image to " << path << "\n";
-                }
-            }
+            saveCurrent();
         }
         // ============ Ctrl+Z =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS &&
             !(glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)) {
-
-            if (!undoStack.empty()) {
-                redoStack.push(currentImage.clone());
-                currentImage = undoStack.top();
-                undoStack.pop();
-                cv::cvtColor(currentImage, currentImage, cv::COLOR_BGR2RGB);
-                UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-            }
+            undo();
         }
         // ========= Ctrl+Shift+Z ======== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) {
-
-            if (!redoStack.empty()) {
-                undoStack.push(currentImage.clone());
-                currentImage = redoStack.top();
-                redoStack.pop();
-                //cv::cvtColor(currentImage, currentImage, cv::COLOR_BGR2RGB);
-                UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-            }
+            redo();
         }
         // ============ Ctrl+C =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
-            cv::Mat tempBGRimg = originalImage.clone();
-            undoStack.push(currentImage.clone());
-            while (!redoStack.empty()) redoStack.pop(); // Clear redo history
-            currentImage = showBlueChannelOnly(tempBGRimg);
-            UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-            singleChannel = true;
+            isolateChannel();
         }
         // ============ Ctrl+G =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
-            //previousImage = currentImage.clone();
-            undoStack.push(currentImage.clone());
-            while (!redoStack.empty()) redoStack.pop();
-            currentImage = toGrayscale(currentImage.clone());
-            UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-            isGrayscale = true;
+            applyToCurrent("grayscale");
         }
         // ============ Ctrl+B =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) {
-            //previousImage = currentImage.clone();
-            undoStack.push(currentImage.clone());
-            while (!redoStack.empty()) redoStack.pop();
-            currentImage = gaussianFilter(currentImage.clone());
-            UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-            //isBlurred = true;
+            applyToCurrent("gaussian_blur");
         }
         // ============ Ctrl+P =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
-            //previousImage = currentImage.clone();
-            undoStack.push(currentImage.clone());
-            while (!redoStack.empty()) redoStack.pop();
-            currentImage = intensityThreshold(currentImage.clone());
-            UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-            isBinary = true;
+            applyToCurrent("threshold");
         }
         // ============ Ctrl+W =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-            if (singleChannel && isGrayscale && isBinary) {
-                watershedOut = runWatershed(currentImage); 
-                //previousImage = currentImage.clone();
-                undoStack.push(currentImage.clone());
-                while (!redoStack.empty()) redoStack.pop();
-                currentImage = watershedOut.watershedOutImg;
-                objectCount = watershedOut.count;
-                //imshow("Display window", currentImage);
-                UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                //std::cout << objectCount << std::endl;
-                cellsSegmented = true;
-                showObjectCntPopup = true;
-            } 
-            else {
-                showPrereqPopup = true;
-            }
+            applyToCurrent("watershed_opencv");
         }
         // ============ Ctrl+1 =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS) {
-            //previousImage = currentImage.clone();
-            undoStack.push(currentImage.clone());
-            while (!redoStack.empty()) redoStack.pop();
-
-            currentImage = showBlueChannelOnly(currentImage);
-            currentImage = toGrayscale(currentImage);
-            currentImage = gaussianFilter(currentImage);
-            currentImage = intensityThreshold(currentImage);
-            
-            watershedOut = runWatershed(currentImage); 
-            currentImage = watershedOut.watershedOutImg;
-            objectCount = watershedOut.count;
-            UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-            //std::cout << objectCount << std::endl;
-            cellsSegmented = true;
-            showObjectCntPopup = true;
+            showSegmentation(runPipeline(openCVPlan, currentValue(), nullptr, &stageCache()));
         }
          // ======== Ctrl+Shift+W ========= //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) {
-            if (singleChannel && isGrayscale && isBinary) {
-                watershedOut = runCustomWatershed(currentImage); 
-                undoStack.push(currentImage.clone());
-                while (!redoStack.empty()) redoStack.pop();
-                currentImage = watershedOut.watershedOutImg;
-                objectCount = watershedOut.count;
-                UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                cellsSegmented = true;
-                showObjectCntPopup = true;
-            } 
-            else {
-                showPrereqPopup = true;
-            }
+            applyToCurrent("watershed_custom");
         }
         // ============ Ctrl+2 =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS) {
-            undoStack.push(currentImage.clone());
-            while (!redoStack.empty()) redoStack.pop();
-            
-            currentImage = showBlueChannelOnly(currentImage);
-            currentImage = toGrayscale(currentImage);
-            currentImage = gaussianFilter(currentImage);
-            currentImage = intensityThreshold(currentImage);
-            
-            watershedOut = runCustomWatershed(currentImage); 
-            currentImage = watershedOut.watershedOutImg;
-            objectCount = watershedOut.count;
-            UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-            cellsSegmented = true;
-            showObjectCntPopup = true;
+            showSegmentation(runPipeline(customPlan, currentValue(), nullptr, &stageCache()));
+        }
+        // ============ Ctrl+3 =========== //
+        if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
+            glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS) {
+            showSegmentation(runPipeline(priorityPlan, currentValue(), nullptr, &stageCache()));
+        }
+        // ============ Ctrl+T =========== //
+        if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
+            glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS && !showTuningWindow) {
+            openTuning();
         }
         // ============ Ctrl+N =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS) {
-            nsis = calculateNSI(watershedOut.markers);
-            cv::Mat labeledImgNSI = drawNSILabels(watershedOut.markers);
-            undoStack.push(currentImage.clone());
-            while (!redoStack.empty()) redoStack.pop();
-            currentImage = labeledImgNSI.clone();
-            UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
+            computeNSI(true);
 
             if (nsis.empty()) {
                 showNSIEmptyPopup = true;
@@ -367,12 +460,7 @@ int main()
         // ============ Ctrl+H =========== //
         if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS &&
             glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS) {
-            cv::Mat NSIheatmap = createNSIHeatmap(watershedOut.markers, nsis);
-            //previousImage = currentImage.clone();
-            undoStack.push(currentImage.clone());
-            while (!redoStack.empty()) redoStack.pop();
-            currentImage = NSIheatmap.clone();
-            UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
+            showHeatmap();
         }
 
         // --------------------------------//
@@ -395,18 +483,12 @@ int main()
                 }
                 ImGui::MenuItem("Open Directory", "TODO");
 
+                if (ImGui::MenuItem("Load Flat-Field Reference...")) {
+                    loadFlatField();
+                }
+
                 if (ImGui::MenuItem("Save", "Ctrl+S")) {
-                        HWND hwnd = glfwGetWin32Window(window); 
-                        std::string path = ShowSaveFileDialog(hwnd);
-
-                        if (!path.empty() && !currentImage.empty()) {
-                            cv::Mat currentImageSave = currentImage.clone();
-                            cv::cvtColor(currentImageSave, currentImageSave, cv::COLOR_RGB2BGR);
-                            bool success = cv::imwrite(path, currentImageSave);
-                            if (!success) {
-                                std::cerr << "Failed to save image to " << path << "\n";
-                            }
-                        }
+                    saveCurrent();
                 }
 
                 if (ImGui::MenuItem("Exit", "Alt+F4")) {
@@ -419,23 +501,11 @@ int main()
             if (ImGui::BeginMenu("Edit")) {
 
                 if (ImGui::MenuItem("Undo", "Ctrl+Z")) {
-                    if (!undoStack.empty()) {
-                        redoStack.push(currentImage.clone());
-                        currentImage = undoStack.top();
-                        undoStack.pop();
-                        cv::cvtColor(currentImage, currentImage, cv::COLOR_BGR2RGB);
-                        UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                    }
+                    undo();
                 }
 
                 if (ImGui::MenuItem("Redo", "Ctrl+Shift+Z")) {
-                    if (!redoStack.empty()) {
-                        undoStack.push(currentImage.clone());
-                        currentImage = redoStack.top();
-                        redoStack.pop();
-                        //cv::cvtColor(currentImage, currentImage, cv::COLOR_BGR2RGB);
-                        UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                    }
+                    redo();
                 }
 
                 ImGui::EndMenu();
@@ -443,36 +513,32 @@ int main()
 
             if (ImGui::BeginMenu("Image")) {
 
+                if (ImGui::MenuItem("Flat-Field Correction", nullptr, false, flatFieldId != 0)) {
+                    correctFlatField();
+                }
+
                 if (ImGui::MenuItem("Isolate Channel", "Ctrl+C")) {
-                    undoStack.push(currentImage.clone());
-                    while (!redoStack.empty()) redoStack.pop();
-                    currentImage = showBlueChannelOnly(originalImage.clone());
-                    UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                    singleChannel = true;
+                    isolateChannel();
                 }
 
                 if (ImGui::MenuItem("Grayscale", "Ctrl+G")) {
-                    undoStack.push(currentImage.clone());
-                    while (!redoStack.empty()) redoStack.pop();
-                    currentImage = toGrayscale(currentImage.clone());
-                    UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                    isGrayscale = true;
+                    applyToCurrent("grayscale");
+                }
+
+                if (ImGui::MenuItem("Subtract Background")) {
+                    applyToCurrent("subtract_background");
+                }
+
+                if (ImGui::MenuItem("Remove Small Objects (Area Opening)")) {
+                    applyToCurrent("attribute_filter");
                 }
 
                 if (ImGui::MenuItem("Gaussian Blur", "Ctrl+B")) {
-                    undoStack.push(currentImage.clone());
-                    while (!redoStack.empty()) redoStack.pop();
-                    currentImage = gaussianFilter(currentImage.clone());
-                    UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                    //isBlurred = true;
+                    applyToCurrent("gaussian_blur");
                 }
 
                 if (ImGui::MenuItem("Threshold Pixel Intensity", "Ctrl+P")) {
-                    undoStack.push(currentImage.clone());
-                    while (!redoStack.empty()) redoStack.pop();
-                    currentImage = intensityThreshold(currentImage.clone());
-                    UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                    isBinary = true;
+                    applyToCurrent("threshold");
                 }
 
                 ImGui::EndMenu();
@@ -481,73 +547,43 @@ int main()
             if (ImGui::BeginMenu("Analyze")) {
 
                 if (ImGui::MenuItem("Object Count (Watershed[OpenCV])", "Ctrl+W")) {
-                    if (singleChannel && isGrayscale && isBinary) {
-                        watershedOut = runWatershed(currentImage); 
-                        undoStack.push(currentImage.clone());
-                        while (!redoStack.empty()) redoStack.pop();
-                        currentImage = watershedOut.watershedOutImg;
-                        objectCount = watershedOut.count;
-                        UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                        cellsSegmented = true;
-                        showObjectCntPopup = true;
-                    } 
-                    else {
-                        showPrereqPopup = true;
-                    }
+                    applyToCurrent("watershed_opencv");
                 }
 
                 if (ImGui::MenuItem("Object Count (pre-processing & Watershed[OpenCV])", "Ctrl+1")) {
-                    undoStack.push(currentImage.clone());
-                    while (!redoStack.empty()) redoStack.pop();
-                    
-                    currentImage = showBlueChannelOnly(currentImage);
-                    currentImage = toGrayscale(currentImage);
-                    currentImage = gaussianFilter(currentImage);
-                    currentImage = intensityThreshold(currentImage);
-                    
-                    WatershedOutput watershedOut = runWatershed(currentImage); 
-                    currentImage = watershedOut.watershedOutImg;
-                    objectCount = watershedOut.count;
-                    UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                    cellsSegmented = true;
-                    showObjectCntPopup = true;
+                    showSegmentation(runPipeline(openCVPlan, currentValue(), nullptr, &stageCache()));
                 }
 
                 if (ImGui::MenuItem("Object Count (Watershed[Custom])", "Ctrl+Shift+W")) {
-                    if (singleChannel && isGrayscale && isBinary) {
-                        watershedOut = runCustomWatershed(currentImage); 
-                        undoStack.push(currentImage.clone());
-                        while (!redoStack.empty()) redoStack.pop();
-                        currentImage = watershedOut.watershedOutImg;
-                        objectCount = watershedOut.count;
-                        UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                        cellsSegmented = true;
-                        showObjectCntPopup = true;
-                    } 
-                    else {
-                        showPrereqPopup = true;
-                    }
+                    applyToCurrent("watershed_custom");
                 }
 
                 if (ImGui::MenuItem("Object Count (pre-processing & Watershed[Custom])", "Ctrl+2")) {
-                    undoStack.push(currentImage.clone());
-                    while (!redoStack.empty()) redoStack.pop();
-                    
-                    currentImage = showBlueChannelOnly(currentImage);
-                    currentImage = toGrayscale(currentImage);
-                    currentImage = gaussianFilter(currentImage);
-                    currentImage = intensityThreshold(currentImage);
-                    
-                    WatershedOutput watershedOut = runCustomWatershed(currentImage); 
-                    currentImage = watershedOut.watershedOutImg;
-                    objectCount = watershedOut.count;
-                    UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
-                    cellsSegmented = true;
-                    showObjectCntPopup = true;
+                    showSegmentation(runPipeline(customPlan, currentValue(), nullptr, &stageCache()));
+                }
+
+                if (ImGui::MenuItem("Object Count (Watershed[Priority])")) {
+                    applyToCurrent("watershed_priority");
+                }
+
+                if (ImGui::MenuItem("Object Count (pre-processing & Watershed[Priority])", "Ctrl+3")) {
+                    showSegmentation(runPipeline(priorityPlan, currentValue(), nullptr, &stageCache()));
+                }
+
+                if (ImGui::MenuItem("Object Count (Watershed[Coarse-to-fine])")) {
+                    applyToCurrent("watershed_coarse");
+                }
+
+                if (ImGui::MenuItem("Object Count (pre-processing & Watershed[Coarse-to-fine])")) {
+                    showSegmentation(runPipeline(coarsePlan, currentValue(), nullptr, &stageCache()));
+                }
+
+                if (ImGui::MenuItem("Segmentation Tuning", "Ctrl+T")) {
+                    openTuning();
                 }
 
                 if (ImGui::MenuItem("NSI Summary", "Ctrl+N")) {
-                    nsis = calculateNSI(watershedOut.markers);
+                    computeNSI(false);
 
                     if (nsis.empty()) {
                         showNSIEmptyPopup = true;
@@ -563,11 +599,7 @@ int main()
                 }
 
                 if (ImGui::MenuItem("NSI Heatmap", "Ctrl+H")) {
-                    cv::Mat NSIheatmap = createNSIHeatmap(watershedOut.markers, nsis);
-                    undoStack.push(currentImage.clone());
-                    while (!redoStack.empty()) redoStack.pop();
-                    currentImage = NSIheatmap.clone();
-                    UpdateTextureFromMat(currentImage, imageTexture, imageWidth, imageHeight);
+                    showHeatmap();
                 }
 
                 ImGui::EndMenu();
@@ -702,6 +734,123 @@ int main()
 
 
 
+        // ------------------------- //
+        // ---- Tuning Window ------ //
+        // ------------------------- //
+
+        if (showTuningWindow) {
+            bool changed = false;   // re-run the proxy
+            bool released = false;  // settle: refine at full resolution
+            auto track = [&](bool edited, bool dragged) {
+                changed = changed || edited;
+                released = released || (dragged ? ImGui::IsItemDeactivatedAfterEdit() : edited);
+            };
+
+            if (ImGui::Begin("Segmentation Tuning", &showTuningWindow, ImGuiWindowFlags_AlwaysAutoResize)) {
+                int engine = tuningEngine;
+                ImGui::RadioButton("Watershed[OpenCV]", &engine, 0);
+                ImGui::SameLine();
+                ImGui::RadioButton("Watershed[Custom]", &engine, 1);
+                ImGui::SameLine();
+                ImGui::RadioButton("Watershed[Priority]", &engine, 2);
+                if (engine != tuningEngine) {
+                    tuningEngine = engine;
+                    tuner.setRecipe(builtinRecipe(engineRecipes[tuningEngine]));
+                    changed = released = true;
+                }
+
+                const char* backgroundMethods[] = { "None", "Top-hat (rolling ball)", "Blurred background" };
+                track(ImGui::Combo("Background", &tuning.backgroundMethod, backgroundMethods, IM_ARRAYSIZE(backgroundMethods)), false);
+                if (tuning.backgroundMethod != BACKGROUND_NONE)
+                    track(ImGui::SliderInt("Background radius", &tuning.backgroundRadius, 5, 400), true);
+                track(ImGui::Checkbox("Recursive blur", &tuning.recursiveBlur), false);
+                if (!tuning.recursiveBlur) tuning.sigma = std::min(tuning.sigma, 10.0f);
+                track(ImGui::SliderFloat("Blur sigma", &tuning.sigma, 0.5f, tuning.recursiveBlur ? 60.0f : 10.0f, "%.1f"), true);
+                const char* thresholdMethods[] = { "Global", "Local mean - C", "Niblack", "Sauvola" };
+                track(ImGui::Combo("Threshold method", &tuning.localMethod, thresholdMethods, IM_ARRAYSIZE(thresholdMethods)), false);
+                if (tuning.localMethod == LOCAL_THRESH_NONE) {
+                    track(ImGui::Checkbox("Otsu threshold", &tuning.otsu), false);
+                    if (!tuning.otsu)
+                        track(ImGui::SliderInt("Threshold", &tuning.threshold, 0, 255), true);
+                } else {
+                    track(ImGui::SliderInt("Window", &tuning.localWindow, 3, 401), true);
+                    if (tuning.localMethod == LOCAL_THRESH_MEAN_C)
+                        track(ImGui::SliderFloat("Offset", &tuning.localOffset, -50.0f, 50.0f, "%.0f"), true);
+                    else
+                        track(ImGui::SliderFloat("k", &tuning.localK, -1.0f, 1.0f, "%.2f"), true);
+                }
+                track(ImGui::SliderInt("Min object area", &tuning.minObjectArea, 0, 2000), true);
+                track(ImGui::SliderInt("Opening iterations", &tuning.openIterations, 0, 8), true);
+                track(ImGui::SliderInt("Dilation iterations", &tuning.dilateIterations, 0, 8), true);
+                track(ImGui::SliderFloat("Foreground fraction", &tuning.thresholdFraction, 0.01f, 0.95f, "%.2f"), true);
+                track(ImGui::SliderInt("Closing kernel", &tuning.closingKernel, 0, 25), true);
+                bool sweepToggled = ImGui::Checkbox("Fraction sweep", &showSweep);
+
+                if (changed) {
+                    int w = 0, h = 0;
+                    const PipelineValue& preview = tuner.preview(tuning);
+                    UpdateTextureFromMat(displayImage(preview), imageTexture, w, h);
+                    tunedReady = false;
+                }
+
+                // Reuses the preview's opening and distance transform, so
+                // only the sweep itself runs
+                if (showSweep && (changed || sweepToggled || fractionSweep.fractions.empty())) {
+                    try {
+                        fractionSweep = tuner.sweep(tuning, sweepFractions(49));
+                    }
+                    catch (const cv::Exception& e) {
+                        std::cerr << "[Error] Fraction sweep: " << e.what() << std::endl;
+                        showSweep = false;
+                    }
+                }
+                if (showSweep && !fractionSweep.fractions.empty()) {
+                    std::vector<float> curve(fractionSweep.seeds.begin(), fractionSweep.seeds.end());
+                    size_t at = std::lower_bound(fractionSweep.fractions.begin(), fractionSweep.fractions.end(),
+                                                 tuning.thresholdFraction) - fractionSweep.fractions.begin();
+                    at = std::min(at, fractionSweep.fractions.size() - 1);
+                    // Raw sure-foreground components: no closing, no splitting
+                    ImGui::PlotLines("Raw seeds", curve.data(), (int)curve.size(), 0,
+                                     "fraction 0.02 .. 0.98, no closing", 0.0f, FLT_MAX, ImVec2(0, 80));
+                    ImGui::Text("At %.2f: %d raw seeds, %d of %d blobs seeded", fractionSweep.fractions[at],
+                                fractionSweep.seeds[at], fractionSweep.detected[at], fractionSweep.blobs);
+                    ImGui::Text("Preview with closing and splitting: %d objects", tuner.lastPreviewObjects());
+                }
+                if (released) tuner.refine(tuning);
+
+                if (tuner.poll(tunedResult)) {
+                    UpdateTextureFromMat(displayImage(tunedResult), imageTexture, imageWidth, imageHeight);
+                    tunedReady = true;
+                }
+
+                ImGui::Separator();
+                ImGui::Text("Preview at 1/%d scale: %.0f ms", (int)std::lround(1.0 / tuner.proxyScale()), tuner.lastPreviewMs());
+                if (tunedReady)
+                    ImGui::Text("Full resolution: %d objects", tunedResult.segmentation.count);
+                else if (tuner.refining())
+                    ImGui::Text("Refining at full resolution...");
+
+                if (!tunedReady) ImGui::BeginDisabled();
+                if (ImGui::Button("Apply")) {
+                    showSegmentation(tunedResult);
+                    showTuningWindow = false;
+                }
+                if (!tunedReady) ImGui::EndDisabled();
+            }
+            ImGui::End();
+
+            // Closed without applying: back to the image being edited
+            if (!showTuningWindow && !currentImage.empty())
+                UpdateTextureFromMat(currentImage.view(), imageTexture, imageWidth, imageHeight);
+        }
+
+        // ------------------------- //
+        // --- ^Tuning Window^ ----- //
+        // ------------------------- //
+
+
+
+
         // ------------------------- //
         // ------ Rendering -------- //
         // ------------------------- //
@@ -713,10 +862,7 @@ int main()
             ImGui::End();
 
             if (!showImageViewer) {
-                singleChannel = false;
-                isGrayscale = false;
-                isBinary = false;
-                cellsSegmented = false;
+                imageTraits = TRAIT_NONE;
             }
         }
 
@@ -863,7 +1009,7 @@ int main()
         else if (key == 'w') {
             if (singleChannel && isGrayscale && isBinary) {
                 WatershedOutput watershedOut = runWatershed(currentImg); 
-                currentImg = watershedOut.watershedOutImg;
+                currentImg = colorizeMarkers(watershedOut.markers);
                 int objectCount = watershedOut.count;
                 imshow("Display window", currentImg);
                 std::cout << objectCount << std::endl;
@@ -881,7 +1027,7 @@ int main()
             currentImg = intensityThreshold(currentImg);
             
             watershedOut = runWatershed(currentImg); 
-            currentImg = watershedOut.watershedOutImg;
+            currentImg = colorizeMarkers(watershedOut.markers);
             int objectCount = watershedOut.count;
             imshow("Display window", currentImg);
 
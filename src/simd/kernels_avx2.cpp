@@ -0,0 +1,154 @@
+// AVX2 row kernels (32 pixels per step). Built with -mavx2 / /arch:AVX2.
+// Two 16-pixel blocks go in the two 128-bit lanes, so the in-lane shuffles,
+// unpacks and packs of the SSE4.2 version carry over unchanged.
+
+#include "simd/kerneltable.h"
+#include "simd/scalarrows.h"
+
+#if defined(__AVX2__)
+#define CYTO_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace simd {
+
+#ifdef CYTO_HAVE_AVX2
+
+namespace {
+
+void channelMasks(int cn, int channel, int esz, __m256i* masks)
+{
+    for (int r = 0; r < cn; ++r) {
+        alignas(16) uint8_t bytes[16];
+        for (int j = 0; j < 16; ++j) {
+            int srcByte = ((j / esz) * cn + channel) * esz + j % esz;
+            bytes[j] = srcByte / 16 == r ? static_cast<uint8_t>(srcByte % 16) : 0x80;
+        }
+        masks[r] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(bytes)));
+    }
+}
+
+// Register r of block 0 in the low lane, of block 1 in the high lane
+inline __m256i loadLanes(const uint8_t* src, int cn, int r)
+{
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16 * r));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16 * cn + 16 * r));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+inline __m256i gatherBlocks(const uint8_t* src, int cn, const __m256i* masks)
+{
+    __m256i v = _mm256_shuffle_epi8(loadLanes(src, cn, 0), masks[0]);
+    for (int r = 1; r < cn; ++r)
+        v = _mm256_or_si256(v, _mm256_shuffle_epi8(loadLanes(src, cn, r), masks[r]));
+    return v;
+}
+
+void extractChannel8u(const uint8_t* src, uint8_t* dst, int width, int cn, int channel)
+{
+    __m256i masks[4];
+    channelMasks(cn, channel, 1, masks);
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), gatherBlocks(src + x * cn, cn, masks));
+    scalar::extractChannel8u(src + x * cn, dst + x, width - x, cn, channel);
+}
+
+void extractChannel16u(const uint16_t* src, uint16_t* dst, int width, int cn, int channel)
+{
+    __m256i masks[4];
+    channelMasks(cn, channel, 2, masks);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i v = gatherBlocks(reinterpret_cast<const uint8_t*>(src + x * cn), cn, masks);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), v);
+    }
+    scalar::extractChannel16u(src + x * cn, dst + x, width - x, cn, channel);
+}
+
+inline __m256i grayQuad(__m256i bg, __m256i r1)
+{
+    const __m256i wBG = _mm256_set1_epi32((9617 << 16) | 1868);
+    const __m256i wR1 = _mm256_set1_epi32((8192 << 16) | 4899);
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(bg, wBG), _mm256_madd_epi16(r1, wR1)), 14);
+}
+
+void bgrToGray8u(const uint8_t* src, uint8_t* dst, int width, int cn)
+{
+    __m256i mb[4], mg[4], mr[4];
+    channelMasks(cn, 0, 1, mb);
+    channelMasks(cn, 1, 1, mg);
+    channelMasks(cn, 2, 1, mr);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        const uint8_t* s = src + x * cn;
+        __m256i b = gatherBlocks(s, cn, mb);
+        __m256i g = gatherBlocks(s, cn, mg);
+        __m256i r = gatherBlocks(s, cn, mr);
+
+        __m256i b0 = _mm256_unpacklo_epi8(b, zero), b1 = _mm256_unpackhi_epi8(b, zero);
+        __m256i g0 = _mm256_unpacklo_epi8(g, zero), g1 = _mm256_unpackhi_epi8(g, zero);
+        __m256i r0 = _mm256_unpacklo_epi8(r, zero), r1 = _mm256_unpackhi_epi8(r, zero);
+
+        __m256i y0 = grayQuad(_mm256_unpacklo_epi16(b0, g0), _mm256_unpacklo_epi16(r0, one));
+        __m256i y1 = grayQuad(_mm256_unpackhi_epi16(b0, g0), _mm256_unpackhi_epi16(r0, one));
+        __m256i y2 = grayQuad(_mm256_unpacklo_epi16(b1, g1), _mm256_unpacklo_epi16(r1, one));
+        __m256i y3 = grayQuad(_mm256_unpackhi_epi16(b1, g1), _mm256_unpackhi_epi16(r1, one));
+
+        __m256i y = _mm256_packus_epi16(_mm256_packs_epi32(y0, y1), _mm256_packs_epi32(y2, y3));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), y);
+    }
+    scalar::bgrToGray8u(src + x * cn, dst + x, width - x, cn);
+}
+
+inline __m256i greaterThan(const uint8_t* src, __m256i biasedLevel)
+{
+    const __m256i bias = _mm256_set1_epi8(static_cast<char>(0x80));
+    __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)), bias);
+    return _mm256_cmpgt_epi8(v, biasedLevel);
+}
+
+void threshold8u(const uint8_t* src, uint8_t* dst, int width, uint8_t level)
+{
+    const __m256i lv = _mm256_set1_epi8(static_cast<char>(level ^ 0x80));
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), greaterThan(src + x, lv));
+    scalar::threshold8u(src + x, dst + x, width - x, level);
+}
+
+void thresholdBits8u(const uint8_t* src, uint64_t* dst, int width, uint8_t level)
+{
+    const __m256i lv = _mm256_set1_epi8(static_cast<char>(level ^ 0x80));
+    int x = 0;
+    for (; x + 64 <= width; x += 64) {
+        uint64_t lo = static_cast<uint32_t>(_mm256_movemask_epi8(greaterThan(src + x, lv)));
+        uint64_t hi = static_cast<uint32_t>(_mm256_movemask_epi8(greaterThan(src + x + 32, lv)));
+        dst[x / 64] = lo | (hi << 32);
+    }
+    scalar::thresholdBits8u(src, dst, width, level, x);
+}
+
+const KernelTable table = {
+    "AVX2",
+    extractChannel8u,
+    extractChannel16u,
+    bgrToGray8u,
+    threshold8u,
+    thresholdBits8u,
+};
+
+}  // namespace
+
+const KernelTable* avx2KernelTable() { return &table; }
+
+#else
+
+const KernelTable* avx2KernelTable() { return nullptr; }
+
+#endif
+
+}  // namespace simd
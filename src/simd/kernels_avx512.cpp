@@ -0,0 +1,148 @@
+// AVX-512 (F + BW) row kernels (64 pixels per step). Built with
+// -mavx512f -mavx512bw / /arch:AVX512. Four 16-pixel blocks go in the four
+// 128-bit lanes; comparisons produce a 64-bit mask directly, which is
+// exactly one word of the bit-packed threshold output.
+
+#include "simd/kerneltable.h"
+#include "simd/scalarrows.h"
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#define CYTO_HAVE_AVX512 1
+#include <immintrin.h>
+#endif
+
+namespace simd {
+
+#ifdef CYTO_HAVE_AVX512
+
+namespace {
+
+void channelMasks(int cn, int channel, int esz, __m512i* masks)
+{
+    for (int r = 0; r < cn; ++r) {
+        alignas(16) uint8_t bytes[16];
+        for (int j = 0; j < 16; ++j) {
+            int srcByte = ((j / esz) * cn + channel) * esz + j % esz;
+            bytes[j] = srcByte / 16 == r ? static_cast<uint8_t>(srcByte % 16) : 0x80;
+        }
+        masks[r] = _mm512_broadcast_i32x4(_mm_load_si128(reinterpret_cast<const __m128i*>(bytes)));
+    }
+}
+
+// Register r of blocks 0..3 in lanes 0..3
+inline __m512i loadLanes(const uint8_t* src, int cn, int r)
+{
+    const int blockBytes = 16 * cn;
+    __m512i v = _mm512_castsi128_si512(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16 * r)));
+    v = _mm512_inserti32x4(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + blockBytes + 16 * r)), 1);
+    v = _mm512_inserti32x4(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * blockBytes + 16 * r)), 2);
+    v = _mm512_inserti32x4(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * blockBytes + 16 * r)), 3);
+    return v;
+}
+
+inline __m512i gatherBlocks(const uint8_t* src, int cn, const __m512i* masks)
+{
+    __m512i v = _mm512_shuffle_epi8(loadLanes(src, cn, 0), masks[0]);
+    for (int r = 1; r < cn; ++r)
+        v = _mm512_or_si512(v, _mm512_shuffle_epi8(loadLanes(src, cn, r), masks[r]));
+    return v;
+}
+
+void extractChannel8u(const uint8_t* src, uint8_t* dst, int width, int cn, int channel)
+{
+    __m512i masks[4];
+    channelMasks(cn, channel, 1, masks);
+    int x = 0;
+    for (; x + 64 <= width; x += 64)
+        _mm512_storeu_si512(dst + x, gatherBlocks(src + x * cn, cn, masks));
+    scalar::extractChannel8u(src + x * cn, dst + x, width - x, cn, channel);
+}
+
+void extractChannel16u(const uint16_t* src, uint16_t* dst, int width, int cn, int channel)
+{
+    __m512i masks[4];
+    channelMasks(cn, channel, 2, masks);
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+        _mm512_storeu_si512(dst + x, gatherBlocks(reinterpret_cast<const uint8_t*>(src + x * cn), cn, masks));
+    scalar::extractChannel16u(src + x * cn, dst + x, width - x, cn, channel);
+}
+
+inline __m512i grayQuad(__m512i bg, __m512i r1)
+{
+    const __m512i wBG = _mm512_set1_epi32((9617 << 16) | 1868);
+    const __m512i wR1 = _mm512_set1_epi32((8192 << 16) | 4899);
+    return _mm512_srli_epi32(_mm512_add_epi32(_mm512_madd_epi16(bg, wBG), _mm512_madd_epi16(r1, wR1)), 14);
+}
+
+void bgrToGray8u(const uint8_t* src, uint8_t* dst, int width, int cn)
+{
+    __m512i mb[4], mg[4], mr[4];
+    channelMasks(cn, 0, 1, mb);
+    channelMasks(cn, 1, 1, mg);
+    channelMasks(cn, 2, 1, mr);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi16(1);
+
+    int x = 0;
+    for (; x + 64 <= width; x += 64) {
+        const uint8_t* s = src + x * cn;
+        __m512i b = gatherBlocks(s, cn, mb);
+        __m512i g = gatherBlocks(s, cn, mg);
+        __m512i r = gatherBlocks(s, cn, mr);
+
+        __m512i b0 = _mm512_unpacklo_epi8(b, zero), b1 = _mm512_unpackhi_epi8(b, zero);
+        __m512i g0 = _mm512_unpacklo_epi8(g, zero), g1 = _mm512_unpackhi_epi8(g, zero);
+        __m512i r0 = _mm512_unpacklo_epi8(r, zero), r1 = _mm512_unpackhi_epi8(r, zero);
+
+        __m512i y0 = grayQuad(_mm512_unpacklo_epi16(b0, g0), _mm512_unpacklo_epi16(r0, one));
+        __m512i y1 = grayQuad(_mm512_unpackhi_epi16(b0, g0), _mm512_unpackhi_epi16(r0, one));
+        __m512i y2 = grayQuad(_mm512_unpacklo_epi16(b1, g1), _mm512_unpacklo_epi16(r1, one));
+        __m512i y3 = grayQuad(_mm512_unpackhi_epi16(b1, g1), _mm512_unpackhi_epi16(r1, one));
+
+        __m512i y = _mm512_packus_epi16(_mm512_packs_epi32(y0, y1), _mm512_packs_epi32(y2, y3));
+        _mm512_storeu_si512(dst + x, y);
+    }
+    scalar::bgrToGray8u(src + x * cn, dst + x, width - x, cn);
+}
+
+void threshold8u(const uint8_t* src, uint8_t* dst, int width, uint8_t level)
+{
+    const __m512i lv = _mm512_set1_epi8(static_cast<char>(level));
+    int x = 0;
+    for (; x + 64 <= width; x += 64) {
+        __mmask64 above = _mm512_cmpgt_epu8_mask(_mm512_loadu_si512(src + x), lv);
+        _mm512_storeu_si512(dst + x, _mm512_movm_epi8(above));
+    }
+    scalar::threshold8u(src + x, dst + x, width - x, level);
+}
+
+void thresholdBits8u(const uint8_t* src, uint64_t* dst, int width, uint8_t level)
+{
+    const __m512i lv = _mm512_set1_epi8(static_cast<char>(level));
+    int x = 0;
+    for (; x + 64 <= width; x += 64)
+        dst[x / 64] = _mm512_cmpgt_epu8_mask(_mm512_loadu_si512(src + x), lv);
+    scalar::thresholdBits8u(src, dst, width, level, x);
+}
+
+const KernelTable table = {
+    "AVX-512",
+    extractChannel8u,
+    extractChannel16u,
+    bgrToGray8u,
+    threshold8u,
+    thresholdBits8u,
+};
+
+}  // namespace
+
+const KernelTable* avx512KernelTable() { return &table; }
+
+#else
+
+const KernelTable* avx512KernelTable() { return nullptr; }
+
+#endif
+
+}  // namespace simd
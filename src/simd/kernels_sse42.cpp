@@ -0,0 +1,150 @@
+// SSE4.2 row kernels (16 pixels per step). Built with -msse4.2 (implied on
+// MSVC x64). See include/simd/kerneltable.h.
+
+#include "simd/kerneltable.h"
+#include "simd/scalarrows.h"
+
+#if defined(__SSE4_2__) || defined(_M_X64) || defined(_M_AMD64)
+#define CYTO_HAVE_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+namespace simd {
+
+#ifdef CYTO_HAVE_SSE42
+
+namespace {
+
+// Shuffle masks that gather one channel out of `cn` consecutive 16-byte
+// registers into a single register (16 / esz pixels)
+void channelMasks(int cn, int channel, int esz, __m128i* masks)
+{
+    for (int r = 0; r < cn; ++r) {
+        alignas(16) uint8_t bytes[16];
+        for (int j = 0; j < 16; ++j) {
+            int srcByte = ((j / esz) * cn + channel) * esz + j % esz;
+            bytes[j] = srcByte / 16 == r ? static_cast<uint8_t>(srcByte % 16) : 0x80;
+        }
+        masks[r] = _mm_load_si128(reinterpret_cast<const __m128i*>(bytes));
+    }
+}
+
+inline __m128i gatherBlock(const uint8_t* src, int cn, const __m128i* masks)
+{
+    __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), masks[0]);
+    for (int r = 1; r < cn; ++r)
+        v = _mm_or_si128(v, _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16 * r)), masks[r]));
+    return v;
+}
+
+void extractChannel8u(const uint8_t* src, uint8_t* dst, int width, int cn, int channel)
+{
+    __m128i masks[4];
+    channelMasks(cn, channel, 1, masks);
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), gatherBlock(src + x * cn, cn, masks));
+    scalar::extractChannel8u(src + x * cn, dst + x, width - x, cn, channel);
+}
+
+void extractChannel16u(const uint16_t* src, uint16_t* dst, int width, int cn, int channel)
+{
+    __m128i masks[4];
+    channelMasks(cn, channel, 2, masks);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i v = gatherBlock(reinterpret_cast<const uint8_t*>(src + x * cn), cn, masks);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), v);
+    }
+    scalar::extractChannel16u(src + x * cn, dst + x, width - x, cn, channel);
+}
+
+// (b*1868 + g*9617 + r*4899 + 2^13) >> 14 for 4 pixels held as 16-bit pairs
+inline __m128i grayQuad(__m128i bg, __m128i r1)
+{
+    const __m128i wBG = _mm_set1_epi32((9617 << 16) | 1868);
+    const __m128i wR1 = _mm_set1_epi32((8192 << 16) | 4899);
+    return _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(bg, wBG), _mm_madd_epi16(r1, wR1)), 14);
+}
+
+void bgrToGray8u(const uint8_t* src, uint8_t* dst, int width, int cn)
+{
+    __m128i mb[4], mg[4], mr[4];
+    channelMasks(cn, 0, 1, mb);
+    channelMasks(cn, 1, 1, mg);
+    channelMasks(cn, 2, 1, mr);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t* s = src + x * cn;
+        __m128i b = gatherBlock(s, cn, mb);
+        __m128i g = gatherBlock(s, cn, mg);
+        __m128i r = gatherBlock(s, cn, mr);
+
+        __m128i b0 = _mm_unpacklo_epi8(b, zero), b1 = _mm_unpackhi_epi8(b, zero);
+        __m128i g0 = _mm_unpacklo_epi8(g, zero), g1 = _mm_unpackhi_epi8(g, zero);
+        __m128i r0 = _mm_unpacklo_epi8(r, zero), r1 = _mm_unpackhi_epi8(r, zero);
+
+        __m128i y0 = grayQuad(_mm_unpacklo_epi16(b0, g0), _mm_unpacklo_epi16(r0, one));
+        __m128i y1 = grayQuad(_mm_unpackhi_epi16(b0, g0), _mm_unpackhi_epi16(r0, one));
+        __m128i y2 = grayQuad(_mm_unpacklo_epi16(b1, g1), _mm_unpacklo_epi16(r1, one));
+        __m128i y3 = grayQuad(_mm_unpackhi_epi16(b1, g1), _mm_unpackhi_epi16(r1, one));
+
+        __m128i y = _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), y);
+    }
+    scalar::bgrToGray8u(src + x * cn, dst + x, width - x, cn);
+}
+
+// Unsigned src > level as a signed compare on sign-flipped bytes
+inline __m128i greaterThan(const uint8_t* src, __m128i biasedLevel)
+{
+    const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+    __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), bias);
+    return _mm_cmpgt_epi8(v, biasedLevel);
+}
+
+void threshold8u(const uint8_t* src, uint8_t* dst, int width, uint8_t level)
+{
+    const __m128i lv = _mm_set1_epi8(static_cast<char>(level ^ 0x80));
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), greaterThan(src + x, lv));
+    scalar::threshold8u(src + x, dst + x, width - x, level);
+}
+
+void thresholdBits8u(const uint8_t* src, uint64_t* dst, int width, uint8_t level)
+{
+    const __m128i lv = _mm_set1_epi8(static_cast<char>(level ^ 0x80));
+    int x = 0;
+    for (; x + 64 <= width; x += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 4; ++k)
+            word |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(greaterThan(src + x + 16 * k, lv)))) << (16 * k);
+        dst[x / 64] = word;
+    }
+    scalar::thresholdBits8u(src, dst, width, level, x);
+}
+
+const KernelTable table = {
+    "SSE4.2",
+    extractChannel8u,
+    extractChannel16u,
+    bgrToGray8u,
+    threshold8u,
+    thresholdBits8u,
+};
+
+}  // namespace
+
+const KernelTable* sse42KernelTable() { return &table; }
+
+#else
+
+const KernelTable* sse42KernelTable() { return nullptr; }
+
+#endif
+
+}  // namespace simd